@@ -10,28 +10,71 @@ enum E7800Cmd
 	ECmd_Execute
 };
 
-struct SCmd7800WriteParam
+// Command packet, the command byte and any parameters are assembled into a
+// single buffer so each command goes out with one write rather than one per
+// field. Parameters are serialised explicitly as little endian.
+
+struct SCmdPacket
 {
-	u32 addr;
-	u32 size;
+	u8		data[16];
+	u32		nSize;
 };
 
-// Start command and send command byte
+static inline void CmdBegin(SCmdPacket *pPacket, E7800Cmd cmd)
+{
+	pPacket->data[0] = (u8)cmd;
+	pPacket->nSize = 1;
+}
+
+static inline void CmdPut8(SCmdPacket *pPacket, const u8 n)
+{
+	pPacket->data[pPacket->nSize++] = n;
+}
+
+static inline void CmdPut16(SCmdPacket *pPacket, const u16 n)
+{
+	CmdPut8(pPacket, (u8)n);
+	CmdPut8(pPacket, (u8)(n >> 8));
+}
+
+static inline void CmdPut32(SCmdPacket *pPacket, const u32 n)
+{
+	CmdPut16(pPacket, (u16)n);
+	CmdPut16(pPacket, (u16)(n >> 16));
+}
+
+// Start command with a line break and send the assembled packet, the packet
+// is copied into the coroutine so the caller's copy can go out of scope
 
-static inline bool CmdSend(const COMPORT h, E7800Cmd cmd)
+static CmdTask CmdSend(CmdLoop &loop, const COMPORT h, const SCmdPacket packet)
 {
-	return ComBreak(h) && ComWrite(h, &cmd, 1);
+	if (!ComSetBreak(h, true))
+	{
+		co_return false;
+	}
+	co_await loop.Delay(1);
+	if (!ComSetBreak(h, false))
+	{
+		co_return false;
+	}
+	co_return co_await loop.Write(h, packet.data, packet.nSize);
 }
 
-// Send command packet including parameters if required
+// Send command packet and wait for acknowledge
 
-static inline bool CmdSimple(const COMPORT h, E7800Cmd cmd, const void *data = 0, const u32 size = 0)
+static CmdTask CmdSimple(CmdLoop &loop, const COMPORT h, const SCmdPacket packet)
 {
-	unsigned char ret;
-	return	CmdSend(h, cmd) && 
-			(size == 0 || ComWrite(h, data, size)) &&
-			ComRead(h, &ret, 1) &&
-			(ret == 0);
+	u8 ret;
+	co_return	co_await CmdSend(loop, h, packet) &&
+				co_await loop.Read(h, &ret, 1) &&
+				(ret == 0);
+}
+
+static CmdTask CmdSimple(CmdLoop &loop, const COMPORT h, E7800Cmd cmd)
+{
+	SCmdPacket packet;
+	CmdBegin(&packet, cmd);
+	return CmdSimple(loop, h, packet);
 }
 
 // Initialise 7800 command
@@ -50,74 +93,161 @@ void CmdTerm(const COMPORT h)
 
 // Request status
 
-bool CmdStatus(const COMPORT h, E7800Status *status)
+CmdTask CmdStatusAsync(CmdLoop &loop, const COMPORT h, E7800Status *status)
 {
-	return CmdSend(h, ECmd_Status) && ComRead(h, status, 1);
+	SCmdPacket packet;
+	CmdBegin(&packet, ECmd_Status);
+	co_return co_await CmdSend(loop, h, packet) && co_await loop.Read(h, status, 1);
 }
 
 // Break currently executing program
 
-bool CmdBreak(const COMPORT h)
+CmdTask CmdBreakAsync(CmdLoop &loop, const COMPORT h)
 {
-	return CmdSimple(h, ECmd_Break);
+	return CmdSimple(loop, h, ECmd_Break);
 }
 
 // Return from break
 
-bool CmdReturn(const COMPORT h)
+CmdTask CmdReturnAsync(CmdLoop &loop, const COMPORT h)
 {
-	return CmdSimple(h, ECmd_Return);
+	return CmdSimple(loop, h, ECmd_Return);
 }
 
-// Write to cartridge memory space
+// Write to cartridge memory space, the data itself can't be sent with the
+// command as the cart must acknowledge the address and size first
+//
+//	u32		addr
+//	u32		size
 
-bool CmdWriteCart(const COMPORT h, const u32 nAddr, const u32 nSize)
+CmdTask CmdWriteCartAsync(CmdLoop &loop, const COMPORT h, const u32 nAddr, const u32 nSize)
 {
-	SCmd7800WriteParam param = { nAddr, nSize };
-	return CmdSimple(h, ECmd_WriteCart, &param, sizeof(SCmd7800WriteParam));
+	SCmdPacket packet;
+	CmdBegin(&packet, ECmd_WriteCart);
+	CmdPut32(&packet, nAddr);
+	CmdPut32(&packet, nSize);
+	return CmdSimple(loop, h, packet);
 }
 
 // Write raw data to cart, used for data upload
 
-bool CmdWriteData(const COMPORT h, const void *pData, const u32 nSize)
+CmdTask CmdWriteDataAsync(CmdLoop &loop, const COMPORT h, const void *pData, const u32 nSize)
 {
-	return ComWrite(h, pData, nSize);
+	co_return co_await loop.Write(h, pData, nSize);
 }
 
 // Check for write data completion
 
-bool CmdWriteDataComplete(const COMPORT h)
+CmdTask CmdWriteDataCompleteAsync(CmdLoop &loop, const COMPORT h)
 {
 	u8 c;
-	return (ComRead(h, &c, 1) && (c == 0));
+	co_return co_await loop.Read(h, &c, 1) && (c == 0);
 }
 
 // Execute ROM (reboot) with given mapper
+//
+//	u8		nMapper
+//	u8		nMapperOptions
+//	u16		nMapperAudio
+//	u16		nMapperIRQEnable
+//	u32		nSize
+//	u16		nExtraFlags
+
+CmdTask CmdExecuteAsync(CmdLoop &loop, const COMPORT h, const u8 nMapper, const u8 nMapperOptions, const u16 nMapperAudio, const u16 nMapperIRQEnable, const u32 nSize, const u16 nExtraFlags)
+{
+	SCmdPacket packet;
+	CmdBegin(&packet, ECmd_Execute);
+	CmdPut8(&packet, nMapper);
+	CmdPut8(&packet, nMapperOptions);
+	CmdPut16(&packet, nMapperAudio);
+	CmdPut16(&packet, nMapperIRQEnable);
+	CmdPut32(&packet, nSize);
+	CmdPut16(&packet, nExtraFlags);
+	return CmdSimple(loop, h, packet);
+}
+
+// Blocking commands, each runs the asynchronous version on its own loop and
+// records how long it took. Failed commands aren't recorded, a timeout says
+// nothing about how long the command normally takes.
 
-#pragma pack(push,1)
-struct SCmdExecute
+static volatile LONG s_nTimeCount[ECmdTime_Count];
+static volatile LONG64 s_nTimeUs[ECmdTime_Count];
+static volatile LONG64 s_nDataBytes;
+
+static u64 CmdTimeUs()
 {
-	u8		nMapper;
-	u8		nMapperOptions;
-	u16		nMapperAudio;
-	u16		nMapperIRQEnable;
-	u32		nSize;
-	u16		nExtraFlags;
-};
-#pragma pack(pop)
+	LARGE_INTEGER nFreq, nNow;
+	QueryPerformanceFrequency(&nFreq);
+	QueryPerformanceCounter(&nNow);
+	return (u64)((nNow.QuadPart * 1000000) / nFreq.QuadPart);
+}
+
+static bool CmdTimed(ECmdTime cmd, u64 nStart, bool bResult, u32 nBytes = 0)
+{
+	if (bResult)
+	{
+		InterlockedIncrement(&s_nTimeCount[cmd]);
+		InterlockedExchangeAdd64(&s_nTimeUs[cmd], (LONG64)(CmdTimeUs() - nStart));
+		InterlockedExchangeAdd64(&s_nDataBytes, nBytes);
+	}
+	return bResult;
+}
+
+bool CmdStatus(const COMPORT h, E7800Status *status)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_Status, nStart, loop.RunTask(CmdStatusAsync(loop, h, status)));
+}
+
+bool CmdBreak(const COMPORT h)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_Break, nStart, loop.RunTask(CmdBreakAsync(loop, h)));
+}
+
+bool CmdReturn(const COMPORT h)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_Return, nStart, loop.RunTask(CmdReturnAsync(loop, h)));
+}
+
+bool CmdWriteCart(const COMPORT h, const u32 nAddr, const u32 nSize)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_WriteCart, nStart, loop.RunTask(CmdWriteCartAsync(loop, h, nAddr, nSize)));
+}
+
+bool CmdWriteData(const COMPORT h, const void *pData, const u32 nSize)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_WriteData, nStart, loop.RunTask(CmdWriteDataAsync(loop, h, pData, nSize)), nSize);
+}
+
+bool CmdWriteDataComplete(const COMPORT h)
+{
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_WriteDataComplete, nStart, loop.RunTask(CmdWriteDataCompleteAsync(loop, h)));
+}
 
 bool CmdExecute(const COMPORT h, const u8 nMapper, const u8 nMapperOptions, const u16 nMapperAudio, const u16 nMapperIRQEnable, const u32 nSize, const u16 nExtraFlags)
 {
-	// send as little endian
-	SCmdExecute mapper =
+	u64 nStart = CmdTimeUs();
+	CmdLoop loop;
+	return CmdTimed(ECmdTime_Execute, nStart, loop.RunTask(CmdExecuteAsync(loop, h, nMapper, nMapperOptions, nMapperAudio, nMapperIRQEnable, nSize, nExtraFlags)));
+}
+
+void CmdGetTimes(SCmdTimes *pTimes)
+{
+	for (int n = 0; n < ECmdTime_Count; n++)
 	{
-		nMapper, 
-		nMapperOptions,
-		nMapperAudio,
-		nMapperIRQEnable,
-		nSize,
-		nExtraFlags
-	};
-
-	return CmdSimple(h, ECmd_Execute, &mapper, sizeof(SCmdExecute));
+		pTimes->nCount[n] = s_nTimeCount[n];
+		pTimes->nTimeUs[n] = s_nTimeUs[n];
+	}
+	pTimes->nDataBytes = s_nDataBytes;
 }
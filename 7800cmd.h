@@ -2,6 +2,7 @@
 #define __7800_CMD_H__
 
 #include "serial.h"
+#include "async.h"
 #include "types.h"
 
 enum E7800Status : u8
@@ -19,6 +20,31 @@ enum E7800ExecuteExtraFlags : u16
 	EExtra_COMPOSITE = 8				// enable strong blending
 };
 
+// largest data block per CmdWriteData, 500000 baud is about 50KB/s so 16K
+// takes around 330ms, inside the 500ms write timeout
+
+static const u32 CMD_DATA_CHUNK = 16384;
+
+enum ECmdTime
+{
+	ECmdTime_Status = 0,
+	ECmdTime_Break,
+	ECmdTime_Return,
+	ECmdTime_WriteCart,
+	ECmdTime_WriteData,
+	ECmdTime_WriteDataComplete,
+	ECmdTime_Execute,
+	ECmdTime_Count
+};
+
+// time spent in the blocking commands, used to calibrate upload estimates
+struct SCmdTimes
+{
+	u32		nCount[ECmdTime_Count];
+	u64		nTimeUs[ECmdTime_Count];
+	u64		nDataBytes;
+};
+
 const COMPORT CmdInit(const char *pCommPort);
 void CmdTerm(const COMPORT h);
 bool CmdStatus(const COMPORT h, E7800Status *status);
@@ -28,5 +54,16 @@ bool CmdWriteCart(const COMPORT h, const u32 nAddr, const u32 nSize);
 bool CmdWriteData(const COMPORT h, const void *pData, const u32 nSize);
 bool CmdWriteDataComplete(const COMPORT h);
 bool CmdExecute(const COMPORT h, const u8 nMapper, const u8 nMapperOptions, const u16 nMapperAudio, const u16 nMapperIRQEnable, const u32 nSize, const u16 nExtraFlags);
+void CmdGetTimes(SCmdTimes *pTimes);
+
+// asynchronous versions, run on the given loop. Buffers passed in must remain
+// valid until the task completes.
+CmdTask CmdStatusAsync(CmdLoop &loop, const COMPORT h, E7800Status *status);
+CmdTask CmdBreakAsync(CmdLoop &loop, const COMPORT h);
+CmdTask CmdReturnAsync(CmdLoop &loop, const COMPORT h);
+CmdTask CmdWriteCartAsync(CmdLoop &loop, const COMPORT h, const u32 nAddr, const u32 nSize);
+CmdTask CmdWriteDataAsync(CmdLoop &loop, const COMPORT h, const void *pData, const u32 nSize);
+CmdTask CmdWriteDataCompleteAsync(CmdLoop &loop, const COMPORT h);
+CmdTask CmdExecuteAsync(CmdLoop &loop, const COMPORT h, const u8 nMapper, const u8 nMapperOptions, const u16 nMapperAudio, const u16 nMapperIRQEnable, const u32 nSize, const u16 nExtraFlags);
 
 #endif // __7800_CMD_H__
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "async.h"
+
+// Queue the awaiting coroutine until the event is signalled
+
+void CmdAwait::await_suspend(std::coroutine_handle<> c)
+{
+	m_coroutine = c;
+	m_pLoop->m_pending.push_back(this);
+}
+
+// Serial io, the transfer is started when awaited
+
+CmdIO::CmdIO(CmdLoop *pLoop, const COMPORT h, void *pData, const u32 nSize, bool bWrite)
+	: CmdAwait(pLoop), m_h(h), m_pData(pData), m_nSize(nSize), m_bWrite(bWrite), m_bResult(false)
+{
+	m_io = {};
+}
+
+CmdIO::~CmdIO()
+{
+	if (m_hEvent)
+	{
+		CloseHandle(m_hEvent);
+	}
+}
+
+bool CmdIO::await_ready()
+{
+	m_hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	m_io.hEvent = m_hEvent;
+
+	// failed to start, nothing to wait for
+	bool bStarted = m_hEvent && (m_bWrite ? ComBeginWrite(m_h, m_pData, m_nSize, &m_io) : ComBeginRead(m_h, m_pData, m_nSize, &m_io));
+	return !bStarted;
+}
+
+void CmdIO::Complete()
+{
+	m_bResult = ComEndIO(m_h, &m_io, m_nSize);
+}
+
+void CmdIO::Cancel()
+{
+	CancelIo(m_h);
+	ComEndIO(m_h, &m_io, m_nSize);
+	m_bResult = false;
+}
+
+// Delay using a waitable timer so other ports keep running
+
+CmdDelay::CmdDelay(CmdLoop *pLoop, const u32 nMs)
+	: CmdAwait(pLoop), m_nMs(nMs)
+{
+	m_hEvent = CreateWaitableTimerA(NULL, TRUE, NULL);
+	if (m_hEvent)
+	{
+		// relative time in 100ns units
+		LARGE_INTEGER nDue;
+		nDue.QuadPart = -(LONGLONG)nMs * 10000;
+		if (!SetWaitableTimer(m_hEvent, &nDue, 0, NULL, NULL, FALSE))
+		{
+			CloseHandle(m_hEvent);
+			m_hEvent = 0;
+		}
+	}
+
+	// no timer, just sleep
+	if (!m_hEvent)
+	{
+		Sleep(nMs);
+	}
+}
+
+CmdDelay::~CmdDelay()
+{
+	if (m_hEvent)
+	{
+		CloseHandle(m_hEvent);
+	}
+}
+
+// Start a task, the loop owns it until the loop is destroyed. Returns the
+// index to get its result with once Run returns.
+
+int CmdLoop::Spawn(CmdTask &&task)
+{
+	m_tasks.push_back(std::move(task));
+	m_tasks.back().Start();
+	return (int)m_tasks.size() - 1;
+}
+
+// Wait for events and resume whoever was waiting on them, runs until nothing
+// is left pending. Only the first MAXIMUM_WAIT_OBJECTS are waited on at once,
+// the rest are picked up as those complete.
+
+void CmdLoop::Run()
+{
+	while (!m_pending.empty())
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+		DWORD nCount = (DWORD)(m_pending.size() < MAXIMUM_WAIT_OBJECTS ? m_pending.size() : MAXIMUM_WAIT_OBJECTS);
+		for (DWORD n = 0; n < nCount; n++)
+		{
+			handles[n] = m_pending[n]->m_hEvent;
+		}
+
+		DWORD nWait = WaitForMultipleObjects(nCount, handles, FALSE, INFINITE);
+		if (nWait < WAIT_OBJECT_0 + nCount)
+		{
+			CmdAwait *pAwait = m_pending[nWait - WAIT_OBJECT_0];
+			m_pending.erase(m_pending.begin() + (nWait - WAIT_OBJECT_0));
+			pAwait->Complete();
+			pAwait->m_coroutine.resume();
+		}
+		else
+		{
+			// wait failed, abandon everything pending so the tasks can finish
+			std::vector<CmdAwait *> pending;
+			pending.swap(m_pending);
+			for (CmdAwait *pAwait : pending)
+			{
+				pAwait->Cancel();
+			}
+			for (CmdAwait *pAwait : pending)
+			{
+				pAwait->m_coroutine.resume();
+			}
+		}
+	}
+}
+
+// Run a single task to completion, used by the blocking commands
+
+bool CmdLoop::RunTask(CmdTask &&task)
+{
+	task.Start();
+	Run();
+	return task.GetResult();
+}
@@ -0,0 +1,145 @@
+#ifndef __7800CMD_ASYNC__
+#define __7800CMD_ASYNC__
+
+#include <coroutine>
+#include <vector>
+#include "serial.h"
+
+// Coroutine task for an asynchronous command, completes with the same bool
+// result as the blocking command. Tasks start suspended and run when awaited
+// or spawned on a loop.
+
+class CmdTask
+{
+public:
+	struct promise_type
+	{
+		bool					bResult = false;
+		std::coroutine_handle<>	continuation;
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+			{
+				std::coroutine_handle<> c = h.promise().continuation;
+				return c ? c : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+
+		CmdTask get_return_object() { return CmdTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_value(bool b) { bResult = b; }
+		void unhandled_exception() { bResult = false; }
+	};
+
+	CmdTask(CmdTask &&task) noexcept : m_h(task.m_h) { task.m_h = 0; }
+	~CmdTask() { if (m_h) m_h.destroy(); }
+	CmdTask(const CmdTask &) = delete;
+	CmdTask &operator=(const CmdTask &) = delete;
+
+	bool IsDone() const { return !m_h || m_h.done(); }
+	bool GetResult() const { return m_h && m_h.done() && m_h.promise().bResult; }
+	void Start() { m_h.resume(); }
+
+	// awaiting a task runs it and resumes the awaiter when it completes
+	bool await_ready() { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) { m_h.promise().continuation = c; return m_h; }
+	bool await_resume() { return m_h.promise().bResult; }
+
+private:
+	explicit CmdTask(std::coroutine_handle<promise_type> h) : m_h(h) {}
+	std::coroutine_handle<promise_type>	m_h;
+};
+
+// Anything the loop can wait on, signalled through an event handle
+
+class CmdLoop;
+class CmdAwait
+{
+public:
+	CmdAwait(CmdLoop *pLoop) : m_pLoop(pLoop), m_hEvent(0) {}
+	CmdAwait(const CmdAwait &) = delete;
+	CmdAwait &operator=(const CmdAwait &) = delete;
+	virtual ~CmdAwait() {}
+
+	void await_suspend(std::coroutine_handle<> c);
+
+	virtual void Complete() = 0;	// event signalled, collect result
+	virtual void Cancel() = 0;		// abandon, must not return until safe to resume
+
+protected:
+	friend class CmdLoop;
+	CmdLoop					*m_pLoop;
+	HANDLE					m_hEvent;
+	std::coroutine_handle<>	m_coroutine;
+};
+
+// Serial read or write
+
+class CmdIO : public CmdAwait
+{
+public:
+	CmdIO(CmdLoop *pLoop, const COMPORT h, void *pData, const u32 nSize, bool bWrite);
+	~CmdIO();
+
+	bool await_ready();
+	bool await_resume() { return m_bResult; }
+
+	void Complete();
+	void Cancel();
+
+private:
+	COMPORT			m_h;
+	COMPORT_IO		m_io;
+	void			*m_pData;
+	u32				m_nSize;
+	bool			m_bWrite;
+	bool			m_bResult;
+};
+
+// Timed wait, used for holding the line break
+
+class CmdDelay : public CmdAwait
+{
+public:
+	CmdDelay(CmdLoop *pLoop, const u32 nMs);
+	~CmdDelay();
+
+	bool await_ready() { return m_hEvent == 0; }
+	void await_resume() {}
+
+	void Complete() {}
+	void Cancel() {}
+
+private:
+	u32				m_nMs;
+};
+
+// Event loop, a single thread can drive any number of ports by spawning a
+// task per port and running the loop until they have all completed
+
+class CmdLoop
+{
+public:
+	CmdIO Write(const COMPORT h, const void *pData, const u32 nSize) { return CmdIO(this, h, (void *)pData, nSize, true); }
+	CmdIO Read(const COMPORT h, void *pData, const u32 nSize) { return CmdIO(this, h, pData, nSize, false); }
+	CmdDelay Delay(const u32 nMs) { return CmdDelay(this, nMs); }
+
+	int Spawn(CmdTask &&task);
+	void Run();
+	bool RunTask(CmdTask &&task);
+
+	// results of spawned tasks, by the index Spawn returned
+	bool IsDone(int nTask) const { return m_tasks[nTask].IsDone(); }
+	bool GetResult(int nTask) const { return m_tasks[nTask].GetResult(); }
+
+private:
+	friend class CmdAwait;
+	std::vector<CmdAwait *>		m_pending;
+	std::vector<CmdTask>		m_tasks;
+};
+
+#endif // __7800CMD_ASYNC__
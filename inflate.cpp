@@ -0,0 +1,418 @@
+#include <string.h>
+#include "inflate.h"
+
+// Deflate decoder (RFC 1951), decodes canonical huffman codes a bit at a time
+// which is much faster than the serial link so there is no point in anything
+// more complicated
+
+static const int INFLATE_MAXBITS = 15;
+static const int INFLATE_WINDOW = 32768;
+
+struct SInflateHuffman
+{
+	s16		count[INFLATE_MAXBITS + 1];		// number of codes of each length
+	s16		symbol[288];					// symbols ordered by code
+};
+
+struct SInflateState
+{
+	// input
+	FILE			*pFile;
+	u32				nInLeft;
+	u8				in[4096];
+	u32				nInPos;
+	u32				nInSize;
+	u32				nBitBuf;
+	u32				nBitCount;
+	bool			bError;
+
+	// output, the window holds the last 32K for back references
+	u8				window[INFLATE_WINDOW];
+	u32				nWinPos;
+	u32				nFlushPos;
+	u32				nTotal;
+	u32				nCRC;
+	InflateOutput	pOutput;
+	void			*pContext;
+};
+
+u32 Crc32(u32 nCRC, const u8 *pData, u32 nSize)
+{
+	static u32 table[256];
+	if (table[1] == 0)
+	{
+		for (u32 n = 0; n < 256; n++)
+		{
+			u32 c = n;
+			for (int k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			}
+			table[n] = c;
+		}
+	}
+
+	nCRC = ~nCRC;
+	while (nSize--)
+	{
+		nCRC = table[(nCRC ^ *pData++) & 0xff] ^ (nCRC >> 8);
+	}
+	return ~nCRC;
+}
+
+static u8 InflateByte(SInflateState *s)
+{
+	if (s->nInPos == s->nInSize)
+	{
+		u32 nRead = s->nInLeft < sizeof(s->in) ? s->nInLeft : sizeof(s->in);
+		s->nInSize = nRead ? (u32)fread(s->in, 1, nRead, s->pFile) : 0;
+		s->nInLeft -= s->nInSize;
+		s->nInPos = 0;
+		if (s->nInSize == 0)
+		{
+			s->bError = true;
+			return 0;
+		}
+	}
+	return s->in[s->nInPos++];
+}
+
+static u32 InflateBits(SInflateState *s, u32 nNeed)
+{
+	u32 nVal = s->nBitBuf;
+	while (s->nBitCount < nNeed)
+	{
+		nVal |= (u32)InflateByte(s) << s->nBitCount;
+		s->nBitCount += 8;
+	}
+	s->nBitBuf = nVal >> nNeed;
+	s->nBitCount -= nNeed;
+	return nVal & ((1u << nNeed) - 1);
+}
+
+// Pass on everything in the window since the last flush
+
+static void InflateFlush(SInflateState *s)
+{
+	if (s->nWinPos > s->nFlushPos && !s->bError)
+	{
+		const u8 *pData = &s->window[s->nFlushPos];
+		u32 nSize = s->nWinPos - s->nFlushPos;
+		s->nCRC = Crc32(s->nCRC, pData, nSize);
+		if (!s->pOutput(s->pContext, pData, nSize))
+		{
+			s->bError = true;
+		}
+	}
+	s->nFlushPos = s->nWinPos;
+}
+
+static void InflateOut(SInflateState *s, u8 c)
+{
+	s->window[s->nWinPos++] = c;
+	s->nTotal++;
+	if (s->nWinPos == INFLATE_WINDOW)
+	{
+		InflateFlush(s);
+		s->nWinPos = 0;
+		s->nFlushPos = 0;
+	}
+}
+
+// Build decoding tables from code lengths, returns 0 for a complete code,
+// positive for an incomplete code and negative for an over subscribed code
+
+static int InflateConstruct(SInflateHuffman *h, const s16 *pLength, int n)
+{
+	s16 offs[INFLATE_MAXBITS + 1];
+
+	memset(h->count, 0, sizeof(h->count));
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		h->count[pLength[symbol]]++;
+	}
+	if (h->count[0] == n)
+	{
+		return 0;
+	}
+
+	int left = 1;
+	for (int len = 1; len <= INFLATE_MAXBITS; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+		{
+			return left;
+		}
+	}
+
+	offs[1] = 0;
+	for (int len = 1; len < INFLATE_MAXBITS; len++)
+	{
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+	for (int symbol = 0; symbol < n; symbol++)
+	{
+		if (pLength[symbol] != 0)
+		{
+			h->symbol[offs[pLength[symbol]]++] = (s16)symbol;
+		}
+	}
+
+	return left;
+}
+
+static int InflateDecode(SInflateState *s, const SInflateHuffman *h)
+{
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len <= INFLATE_MAXBITS; len++)
+	{
+		code |= InflateBits(s, 1);
+		int count = h->count[len];
+		if (code - count < first)
+		{
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static bool InflateStored(SInflateState *s)
+{
+	// stored blocks start on a byte boundary
+	s->nBitBuf = 0;
+	s->nBitCount = 0;
+
+	u32 nLen = InflateByte(s);
+	nLen |= InflateByte(s) << 8;
+	u32 nCheck = InflateByte(s);
+	nCheck |= InflateByte(s) << 8;
+	if (nLen != (~nCheck & 0xffff))
+	{
+		return false;
+	}
+
+	while (nLen-- && !s->bError)
+	{
+		InflateOut(s, InflateByte(s));
+	}
+	return !s->bError;
+}
+
+static bool InflateCodes(SInflateState *s, const SInflateHuffman *pLenCode, const SInflateHuffman *pDistCode)
+{
+	static const s16 lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const s16 lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const s16 dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const s16 dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	int symbol;
+	do
+	{
+		symbol = InflateDecode(s, pLenCode);
+		if (symbol < 0 || s->bError)
+		{
+			return false;
+		}
+
+		// literal
+		if (symbol < 256)
+		{
+			InflateOut(s, (u8)symbol);
+		}
+
+		// length and distance back reference
+		else if (symbol > 256)
+		{
+			symbol -= 257;
+			if (symbol >= 29)
+			{
+				return false;
+			}
+			u32 nLen = lbase[symbol] + InflateBits(s, lext[symbol]);
+
+			symbol = InflateDecode(s, pDistCode);
+			if (symbol < 0 || symbol >= 30)
+			{
+				return false;
+			}
+			u32 nDist = dbase[symbol] + InflateBits(s, dext[symbol]);
+			if (nDist > s->nTotal)
+			{
+				return false;
+			}
+
+			while (nLen--)
+			{
+				InflateOut(s, s->window[(s->nWinPos - nDist) & (INFLATE_WINDOW - 1)]);
+			}
+		}
+	}
+	while (symbol != 256);
+
+	return !s->bError;
+}
+
+static bool InflateFixed(SInflateState *s)
+{
+	static SInflateHuffman lencode, distcode;
+	static bool bBuilt = false;
+
+	if (!bBuilt)
+	{
+		s16 lengths[288];
+		int n = 0;
+		for (; n < 144; n++) lengths[n] = 8;
+		for (; n < 256; n++) lengths[n] = 9;
+		for (; n < 280; n++) lengths[n] = 7;
+		for (; n < 288; n++) lengths[n] = 8;
+		InflateConstruct(&lencode, lengths, 288);
+
+		for (n = 0; n < 30; n++) lengths[n] = 5;
+		InflateConstruct(&distcode, lengths, 30);
+		bBuilt = true;
+	}
+
+	return InflateCodes(s, &lencode, &distcode);
+}
+
+static bool InflateDynamic(SInflateState *s)
+{
+	static const s16 order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	s16 lengths[320];
+	SInflateHuffman lencode, distcode;
+
+	int nLen = InflateBits(s, 5) + 257;
+	int nDist = InflateBits(s, 5) + 1;
+	int nCode = InflateBits(s, 4) + 4;
+	if (nLen > 286 || nDist > 30)
+	{
+		return false;
+	}
+
+	// code length code lengths, must be complete
+	int index;
+	for (index = 0; index < nCode; index++)
+	{
+		lengths[order[index]] = (s16)InflateBits(s, 3);
+	}
+	for (; index < 19; index++)
+	{
+		lengths[order[index]] = 0;
+	}
+	if (InflateConstruct(&lencode, lengths, 19) != 0)
+	{
+		return false;
+	}
+
+	// literal/length and distance code lengths
+	index = 0;
+	while (index < nLen + nDist)
+	{
+		int symbol = InflateDecode(s, &lencode);
+		if (symbol < 0 || s->bError)
+		{
+			return false;
+		}
+
+		if (symbol < 16)
+		{
+			lengths[index++] = (s16)symbol;
+		}
+		else
+		{
+			s16 len = 0;
+			if (symbol == 16)
+			{
+				if (index == 0)
+				{
+					return false;
+				}
+				len = lengths[index - 1];
+				symbol = 3 + InflateBits(s, 2);
+			}
+			else if (symbol == 17)
+			{
+				symbol = 3 + InflateBits(s, 3);
+			}
+			else
+			{
+				symbol = 11 + InflateBits(s, 7);
+			}
+
+			if (index + symbol > nLen + nDist)
+			{
+				return false;
+			}
+			while (symbol--)
+			{
+				lengths[index++] = len;
+			}
+		}
+	}
+
+	// must have an end of block code
+	if (lengths[256] == 0)
+	{
+		return false;
+	}
+
+	// incomplete codes only allowed for a single length 1 code
+	int err = InflateConstruct(&lencode, lengths, nLen);
+	if (err && (err < 0 || nLen != lencode.count[0] + lencode.count[1]))
+	{
+		return false;
+	}
+	err = InflateConstruct(&distcode, lengths + nLen, nDist);
+	if (err && (err < 0 || nDist != distcode.count[0] + distcode.count[1]))
+	{
+		return false;
+	}
+
+	return InflateCodes(s, &lencode, &distcode);
+}
+
+bool Inflate(FILE *pFile, u32 nCompressedSize, InflateOutput pOutput, void *pContext, u32 *pCRC)
+{
+	SInflateState *s = new SInflateState;
+	s->pFile = pFile;
+	s->nInLeft = nCompressedSize;
+	s->nInPos = 0;
+	s->nInSize = 0;
+	s->nBitBuf = 0;
+	s->nBitCount = 0;
+	s->bError = false;
+	s->nWinPos = 0;
+	s->nFlushPos = 0;
+	s->nTotal = 0;
+	s->nCRC = 0;
+	s->pOutput = pOutput;
+	s->pContext = pContext;
+
+	bool bOk = true;
+	u32 nLast;
+	do
+	{
+		nLast = InflateBits(s, 1);
+		switch (InflateBits(s, 2))
+		{
+			case 0:		bOk = InflateStored(s);		break;
+			case 1:		bOk = InflateFixed(s);		break;
+			case 2:		bOk = InflateDynamic(s);	break;
+			default:	bOk = false;				break;
+		}
+	}
+	while (bOk && !nLast && !s->bError);
+
+	InflateFlush(s);
+	bOk = bOk && !s->bError;
+	*pCRC = s->nCRC;
+	delete s;
+	return bOk;
+}
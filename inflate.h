@@ -0,0 +1,17 @@
+#ifndef __7800CMD_INFLATE__
+#define __7800CMD_INFLATE__
+
+#include <stdio.h>
+#include "types.h"
+
+// Output callback for decompressed data, return false to stop decompression
+typedef bool (*InflateOutput)(void *pContext, const u8 *pData, u32 nSize);
+
+// Decompress a raw deflate stream from the current file position, reading
+// no more than nCompressedSize bytes. Output is passed on in pieces as it
+// is produced and the CRC32 of all output is returned.
+bool Inflate(FILE *pFile, u32 nCompressedSize, InflateOutput pOutput, void *pContext, u32 *pCRC);
+
+u32 Crc32(u32 nCRC, const u8 *pData, u32 nSize);
+
+#endif // __7800CMD_INFLATE__
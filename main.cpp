@@ -1,31 +1,52 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <future>
+#include <vector>
 #include "7800cmd.h"
+#include "manifest.h"
 #include "mapper.h"
+#include "plan.h"
+#include "romstream.h"
+#include "scan.h"
+#include "soak.h"
 
 void Usage(const char *cmd)
 {
-	printf("%s -com {comport:} [-run rom.a78]\n", cmd);
+	printf("%s -scan\n", cmd);
+	printf("rom can be file.a78, file.a78.gz or archive.zip:file.a78\n");
+	printf("%s [-com {comport:}] -manifest file.txt [-full] [-exec options]\n", cmd);
+	printf("%s [-com {comport:}] -run rom|-manifest file.txt [options] -dryrun\n", cmd);
+	printf("%s [-com {comport:}] -run rom -soak [-iterations n] [-duration s] [-seed n]\n", cmd);
+	printf("%s [-com {comport:}] [-run rom] [-exec] [-audio n,..] [-irq n,..] [-extra n,..] [-delay ms] [-stats]\n", cmd);
 }
 
-bool UploadToCart(const COMPORT com, FILE *f, u32 nOffset, u32 nLoadAddr, u32 nSize)
+// Upload to the cart, data comes from the rom stream or from memory if no
+// stream is given
+
+bool UploadToCart(const COMPORT com, RomStream *pRom, const u8 *pData, u32 nLoadAddr, u32 nSize)
 {
 	if (CmdWriteCart(com, nLoadAddr, nSize))
 	{
-		fseek(f, nOffset, SEEK_SET);
-
 		// write accepted, send the data
 		printf("Writing %dK to $%05x: ", nSize / 1024, nLoadAddr);
 
 		// read from file and write to serial
 		u32 nLeft = nSize;
+		bool bReadError = false;
 		while (nLeft)
 		{
-			u8 buf[4096];
-			u32 nRead = nLeft > 4096 ? 4096 : nLeft;
+			u8 buf[CMD_DATA_CHUNK];
+			u32 nRead = nLeft > CMD_DATA_CHUNK ? CMD_DATA_CHUNK : nLeft;
+			const u8 *pChunk = pRom ? buf : pData + (nSize - nLeft);
 
-			fread(buf, 1, nRead, f);
 			printf("+");
-			if (CmdWriteData(com, buf, nRead))
+			if (pRom && pRom->Read(buf, nRead) != nRead)
+			{
+				bReadError = true;
+				break;
+			}
+			if (CmdWriteData(com, pChunk, nRead))
 			{
 				printf("\b*");
 			}
@@ -44,6 +65,10 @@ bool UploadToCart(const COMPORT com, FILE *f, u32 nOffset, u32 nLoadAddr, u32 nS
 		else
 		{
 			printf(" ERROR\n");
+			if (bReadError)
+			{
+				printf("Unable to read ROM (%s)...\n", pRom->GetError());
+			}
 			return false;
 		}
 	}
@@ -54,9 +79,376 @@ bool UploadToCart(const COMPORT com, FILE *f, u32 nOffset, u32 nLoadAddr, u32 nS
 	}
 }
 
-bool IsBankset(const GDMapperInfo *pInfo)
+// Override list for an execute header field, empty uses the value from the ROM
+
+struct SOverrideList
+{
+	u16		nValues[16];
+	int		nCount;
+};
+
+// Parse a comma separated list of values, decimal or hex with 0x or $ prefix
+
+bool ParseOverrideList(SOverrideList *pList, const char *pText)
+{
+	pList->nCount = 0;
+	while (*pText && pList->nCount < (int)COUNTOF(pList->nValues))
+	{
+		// a number must follow the $ prefix and each comma
+		bool bHex = (*pText == '$');
+		const char *pDigits = bHex ? pText + 1 : pText;
+		if (!(bHex ? isxdigit((u8)*pDigits) : isdigit((u8)*pDigits)))
+		{
+			return false;
+		}
+
+		char *pEnd;
+		u32 nValue = strtoul(pDigits, &pEnd, bHex ? 16 : 0);
+		if (nValue > 0xffff)
+		{
+			return false;
+		}
+		pList->nValues[pList->nCount++] = (u16)nValue;
+		pText = (*pEnd == ',' && pEnd[1]) ? pEnd + 1 : pEnd;
+	}
+	return (*pText == 0) && (pList->nCount > 0);
+}
+
+static u16 GetOverride(const SOverrideList *pList, int nIndex, u16 nDefault)
+{
+	return pList->nCount ? pList->nValues[nIndex] : nDefault;
+}
+
+// Make sure the cart is in a state to accept commands (menu or in break)
+
+bool BreakIfRunning(const COMPORT com)
+{
+	E7800Status status;
+	if (!CmdStatus(com, &status))
+	{
+		printf("Unable to get status.\n");
+		return false;
+	}
+
+	if (status == EStatus_Running && !CmdBreak(com))
+	{
+		printf("Unable to break.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Port side of startup, run on its own thread while the ROM is opened. The
+// port is opened and the status read straight away, but a running game is
+// only broken once the ROM is known to be good. When probing a cached port
+// the status uses a short timeout and doubles as the check that the 7800GD
+// is still there.
+
+struct SHandshake
+{
+	COMPORT			com;
+	E7800Status		status;		// status before any break
+	bool			bFound;		// 7800GD answered
+	bool			bReady;		// in menu or break, ready to upload
+	u64				nReadyMs;
+};
+
+SHandshake Handshake(const char *pPort, std::shared_future<bool> romValid, bool bProbe)
 {
-	return ((pInfo->nMapper == EA78_V4_MAPPER_LINEAR || pInfo->nMapper == EA78_V4_MAPPER_SUPERGAME) && (pInfo->nMapperOptions & EA78_V4_MAPPER_LINEAR_BANKSET));
+	SHandshake hs = { COMPORT_INVALID, EStatus_Menu, false, false, 0 };
+	hs.com = CmdInit(pPort);
+	if (hs.com != COMPORT_INVALID)
+	{
+		hs.bFound = (!bProbe || ComSetTimeout(hs.com, 100))
+			&& CmdStatus(hs.com, &hs.status) && hs.status <= EStatus_Menu
+			&& (!bProbe || ComSetTimeout(hs.com, 500));
+
+		if (!hs.bFound)
+		{
+			if (!bProbe)
+			{
+				printf("Unable to get status.\n");
+			}
+		}
+		else if (hs.status != EStatus_Running)
+		{
+			hs.bReady = true;
+		}
+		else if (romValid.get())
+		{
+			hs.bReady = CmdBreak(hs.com);
+			if (!hs.bReady)
+			{
+				printf("Unable to break.\n");
+			}
+		}
+	}
+	hs.nReadyMs = GetTickCount64();
+	return hs;
+}
+
+// Execute the ROM once for every combination of header overrides. The image
+// is already on the cart so each variant after the first is only a break and
+// execute, no upload.
+
+void ExecuteVariants(const COMPORT com, const GDMapperInfo *pMapper, const SOverrideList *pAudio, const SOverrideList *pIRQ, const SOverrideList *pExtra, bool bStopped, u32 nDelay)
+{
+	bool bOverride = pAudio->nCount || pIRQ->nCount || pExtra->nCount;
+	int nAudioCount = pAudio->nCount ? pAudio->nCount : 1;
+	int nIRQCount = pIRQ->nCount ? pIRQ->nCount : 1;
+	int nExtraCount = pExtra->nCount ? pExtra->nCount : 1;
+	int nVariants = nAudioCount * nIRQCount * nExtraCount;
+
+	for (int n = 0; n < nVariants; n++)
+	{
+		u16 nAudio = GetOverride(pAudio, n / (nIRQCount * nExtraCount), pMapper->nMapperAudio);
+		u16 nIRQ = GetOverride(pIRQ, (n / nExtraCount) % nIRQCount, pMapper->nMapperIRQEnable);
+		u16 nExtra = GetOverride(pExtra, n % nExtraCount, pMapper->nExtraFlags);
+
+		// wait before relaunching the next variant
+		if (n > 0)
+		{
+			if (nDelay)
+			{
+				Sleep(nDelay);
+			}
+			else
+			{
+				printf("Press Enter for next variant...");
+				int c;
+				while ((c = getchar()) != '\n' && c != EOF);
+				if (c == EOF)
+				{
+					printf("\nNo more input, stopping sweep.\n");
+					return;
+				}
+			}
+		}
+
+		ULONGLONG nStart = GetTickCount64();
+		if ((bStopped || BreakIfRunning(com))
+			&& CmdExecute(	com,
+							pMapper->nMapper,
+							pMapper->nMapperOptions,
+							nAudio,
+							nIRQ,
+							pMapper->nSize,
+							nExtra))
+		{
+			if (bOverride)
+			{
+				printf("Executing audio $%04x irq $%04x extra $%04x (%dms)...\n", nAudio, nIRQ, nExtra, (int)(GetTickCount64() - nStart));
+			}
+			else
+			{
+				printf("Executing...\n");
+			}
+		}
+		else
+		{
+			printf("Unable to execute.\n");
+			return;
+		}
+
+		bStopped = false;
+	}
+}
+
+// Find the 7800GD by probing all ports, the first found is cached for next
+// time. Listing shows every port and the result of probing it.
+
+const char *FindPort(char *pDevice, u32 nSize, bool bScan)
+{
+	static const char *pStatus[] = { "running", "stopped", "menu" };
+
+	int nFound = 0;
+	SPortProbe probes[64];
+	int nPorts = ScanPorts(probes, COUNTOF(probes), 100);
+	int nFirst = -1;
+	for (int n = 0; n < nPorts; n++)
+	{
+		if (probes[n].bFound)
+		{
+			if (bScan)
+			{
+				printf("%-8s 7800GD %-8s %d.%03dms\n", probes[n].szPort, pStatus[probes[n].status], probes[n].nLatencyUs / 1000, probes[n].nLatencyUs % 1000);
+			}
+			nFirst = nFirst < 0 ? n : nFirst;
+			nFound++;
+		}
+		else if (bScan)
+		{
+			printf("%-8s no response\n", probes[n].szPort);
+		}
+	}
+
+	if (nFirst < 0)
+	{
+		printf("No 7800GD found.\n");
+		return 0;
+	}
+
+	// the first found is used until told otherwise
+	if (nFound > 1)
+	{
+		printf("Using 7800GD on %s, %d were found (-com to pick another)\n", probes[nFirst].szPort, nFound);
+	}
+	ScanSaveCache(probes[nFirst].szPort, nFound);
+	sprintf_s(pDevice, nSize, "\\\\.\\%s", probes[nFirst].szPort);
+	return pDevice;
+}
+
+// Upload the segments of a manifest in address order and execute. Only
+// segments that changed since the last upload to this port are sent, unless
+// asked for everything or the cart was at the menu (and so may have had
+// something else loaded since). The cart is already in menu or break.
+
+void RunManifest(const COMPORT com, E7800Status status, SManifest &manifest, const char *pPort, const char *pPath, bool bFull, const SOverrideList *pAudio, const SOverrideList *pIRQ, const SOverrideList *pExtra, u32 nDelay)
+{
+	if (!bFull && status != EStatus_Menu)
+	{
+		ManifestCompare(&manifest, pPath, pPort);
+	}
+
+	// cart contents are unknown until everything is sent
+	ManifestClearCache(pPath);
+	ManifestForgetPort(pPort);
+	for (const SManifestSegment &segment : manifest.segments)
+	{
+		if (!segment.bChanged)
+		{
+			printf("Skipping %dK at $%05x, unchanged\n", (u32)segment.data.size() / 1024, segment.nAddr);
+		}
+		else if (!UploadToCart(com, 0, segment.data.data(), segment.nAddr, (u32)segment.data.size()))
+		{
+			return;
+		}
+	}
+
+	ManifestSaveCache(&manifest, pPath, pPort);
+	ExecuteVariants(com, &manifest.mapper, pAudio, pIRQ, pExtra, true, nDelay);
+}
+
+// Work out the commands a run would make, without opening the port, and
+// estimate how long it would take on this port
+
+void DryRun(const char *pPort, const char *pRunRom, const char *pManifest, bool bFull, bool bExecOnly, int nVariants)
+{
+	std::vector<SPlanStep> plan;
+	bool bStopped = true;
+
+	if (pManifest)
+	{
+		SManifest manifest;
+		if (!ManifestLoad(&manifest, pManifest))
+		{
+			return;
+		}
+		if (!bFull)
+		{
+			ManifestCompare(&manifest, pManifest, pPort);
+		}
+
+		PlanAdd(&plan, ECmdTime_Status);
+		PlanAdd(&plan, ECmdTime_Break, true);
+		for (const SManifestSegment &segment : manifest.segments)
+		{
+			if (segment.bChanged)
+			{
+				PlanAddUpload(&plan, segment.nAddr, (u32)segment.data.size());
+			}
+			else
+			{
+				printf("Skipping %dK at $%05x if the cart still has it\n", (u32)segment.data.size() / 1024, segment.nAddr);
+			}
+		}
+	}
+	else
+	{
+		RomStream rom;
+		u8 header[A78_HEADER_SIZE];
+		GDMapperInfo mapper;
+		if (!rom.Open(pRunRom) || rom.Read(header, sizeof(header)) != sizeof(header) || !Get7800Mapper(&mapper, header))
+		{
+			printf("File is not valid '%s'...\n", pRunRom);
+			return;
+		}
+
+		if (bExecOnly)
+		{
+			bStopped = false;
+		}
+		else
+		{
+			PlanAdd(&plan, ECmdTime_Status);
+			PlanAdd(&plan, ECmdTime_Break, true);
+			PlanAddUpload(&plan, mapper.nLoadAddr, mapper.nSize);
+			if (IsBankset(&mapper))
+			{
+				PlanAddUpload(&plan, mapper.nLoadAddr | 0x80000, mapper.nSize);
+			}
+		}
+	}
+
+	// each variant after the first breaks again before executing
+	for (int n = 0; n < nVariants; n++)
+	{
+		if (n > 0 || !bStopped)
+		{
+			PlanAdd(&plan, ECmdTime_Status);
+			PlanAdd(&plan, ECmdTime_Break, true);
+		}
+		PlanAdd(&plan, ECmdTime_Execute);
+	}
+
+	printf("Plan for '%s':\n", pManifest ? pManifest : pRunRom);
+	SPlanModel model;
+	PlanLoadModel(&model, pPort);
+	PlanPrint(&plan, &model, pPort);
+}
+
+// Compare a real run against the model and calibrate from it, only runs
+// that got as far as a successful execute are used
+
+void ReportRun(const char *pPort, const SCmdTimes *pBefore)
+{
+	SCmdTimes after, run;
+	CmdGetTimes(&after);
+	PlanDelta(&run, pBefore, &after);
+	if (run.nCount[ECmdTime_Execute] == 0)
+	{
+		return;
+	}
+
+	SPlanModel model;
+	PlanLoadModel(&model, pPort);
+
+	// the model only covers time on the port, so compare against the time
+	// spent in commands rather than waiting on the ROM or the user. Execute
+	// only runs are too short for the comparison to mean anything.
+	if (run.nDataBytes)
+	{
+		u64 nCommandUs = 0;
+		for (int n = 0; n < ECmdTime_Count; n++)
+		{
+			nCommandUs += run.nTimeUs[n];
+		}
+
+		float fPredicted = PlanEstimate(&model, &run) / 1000.0f;
+		float fActual = nCommandUs / 1000000.0f;
+		float fError = fPredicted > 0.0f ? (fActual - fPredicted) * 100.0f / fPredicted : 0.0f;
+		printf("Commands took %.2fs, predicted %.2fs (%+.0f%%)\n", fActual, fPredicted, fError);
+		// start the run count again so recent runs outweigh the history
+		if (model.nRuns >= 3 && (fError > 25.0f || fError < -25.0f))
+		{
+			printf("Upload model has drifted, recalibrating from recent runs.\n");
+			model.nRuns = 1;
+		}
+	}
+
+	PlanCalibrate(&model, &run);
+	PlanSaveModel(&model, pPort);
 }
 
 int main(int argc, const char **argv)
@@ -74,6 +466,19 @@ int main(int argc, const char **argv)
 
 	const char *pComPort = 0;
 	const char *pRunRom = 0;
+	bool bStats = false;
+	bool bScan = false;
+	bool bSoak = false;
+	bool bFull = false;
+	bool bDryRun = false;
+	const char *pManifest = 0;
+	SSoakConfig soak = { 1000, 0, 1, 10 };
+	bool bIterations = false;
+	bool bExecOnly = false;
+	u32 nDelay = 0;
+	SOverrideList sAudio = { {0}, 0 };
+	SOverrideList sIRQ = { {0}, 0 };
+	SOverrideList sExtra = { {0}, 0 };
 
 	for (int n = 1; n < argc; n++)
 	{
@@ -88,87 +493,293 @@ int main(int argc, const char **argv)
 		{
 			pRunRom = argv[++n];
 		}
+
+		// segments listed in a manifest
+		else if ((_stricmp(argv[n], "-manifest") == 0) && ((n + 1) < argc))
+		{
+			pManifest = argv[++n];
+		}
+		else if (_stricmp(argv[n], "-full") == 0)
+		{
+			bFull = true;
+		}
+
+		// execute image already on the cart, no upload
+		else if (_stricmp(argv[n], "-exec") == 0)
+		{
+			bExecOnly = true;
+		}
+
+		// header overrides, a list of values sweeps all combinations
+		else if ((_stricmp(argv[n], "-audio") == 0) && ((n + 1) < argc))
+		{
+			if (!ParseOverrideList(&sAudio, argv[++n]))
+			{
+				printf("Invalid -audio list '%s'...\n", argv[n]);
+				return 0;
+			}
+		}
+		else if ((_stricmp(argv[n], "-irq") == 0) && ((n + 1) < argc))
+		{
+			if (!ParseOverrideList(&sIRQ, argv[++n]))
+			{
+				printf("Invalid -irq list '%s'...\n", argv[n]);
+				return 0;
+			}
+		}
+		else if ((_stricmp(argv[n], "-extra") == 0) && ((n + 1) < argc))
+		{
+			if (!ParseOverrideList(&sExtra, argv[++n]))
+			{
+				printf("Invalid -extra list '%s'...\n", argv[n]);
+				return 0;
+			}
+		}
+
+		// delay between variants rather than waiting for a key
+		else if ((_stricmp(argv[n], "-delay") == 0) && ((n + 1) < argc))
+		{
+			nDelay = strtoul(argv[++n], 0, 0);
+		}
+
+		// probe all ports for a 7800GD
+		else if (_stricmp(argv[n], "-scan") == 0)
+		{
+			bScan = true;
+		}
+
+		// soak test using the rom, com port can be "sim" for a simulated device
+		else if (_stricmp(argv[n], "-soak") == 0)
+		{
+			bSoak = true;
+		}
+		else if ((_stricmp(argv[n], "-iterations") == 0) && ((n + 1) < argc))
+		{
+			soak.nIterations = strtoul(argv[++n], 0, 0);
+			bIterations = true;
+		}
+		else if ((_stricmp(argv[n], "-duration") == 0) && ((n + 1) < argc))
+		{
+			soak.nDuration = strtoul(argv[++n], 0, 0);
+		}
+		else if ((_stricmp(argv[n], "-seed") == 0) && ((n + 1) < argc))
+		{
+			soak.nSeed = strtoul(argv[++n], 0, 0);
+		}
+
+		// show what would be done and how long it should take
+		else if (_stricmp(argv[n], "-dryrun") == 0 || _stricmp(argv[n], "--dry-run") == 0)
+		{
+			bDryRun = true;
+		}
+
+		// show serial call counts when done
+		else if (_stricmp(argv[n], "-stats") == 0)
+		{
+			bStats = true;
+		}
+	}
+
+	// a soak for a given time shouldn't stop early at the default iterations
+	if (soak.nDuration && !bIterations)
+	{
+		soak.nIterations = 0;
+	}
+
+	int nVariants = (sAudio.nCount ? sAudio.nCount : 1) * (sIRQ.nCount ? sIRQ.nCount : 1) * (sExtra.nCount ? sExtra.nCount : 1);
+
+	// dry run uses the cached port rather than probing, port names are
+	// normalised so this finds the same model and manifest cache as a real run
+	if (bDryRun && (pRunRom || pManifest))
+	{
+		char szPort[16];
+		if (!pComPort && ScanLoadCache(szPort, sizeof(szPort)))
+		{
+			pComPort = szPort;
+		}
+		DryRun(pComPort, pRunRom, pManifest, bFull, bExecOnly, nVariants);
+		return 0;
+	}
+
+	// startup is timed from here, finding the port included
+	u64 nLaunchMs = GetTickCount64();
+
+	// find the port if not given, or list all found. Without a scan the
+	// cached port is used directly, the handshake checks it's still there.
+	char szDevice[32];
+	char szCached[16];
+	int nFound;
+	bool bCachedPort = false;
+	if (!bScan && (pRunRom || pManifest) && !pComPort && ScanLoadCache(szCached, sizeof(szCached), &nFound))
+	{
+		if (nFound > 1)
+		{
+			printf("Using 7800GD on %s, %d were found (-com to pick another)\n", szCached, nFound);
+		}
+		sprintf_s(szDevice, sizeof(szDevice), "\\\\.\\%s", szCached);
+		pComPort = szDevice;
+		bCachedPort = true;
+	}
+	else if (bScan || ((pRunRom || pManifest) && !pComPort))
+	{
+		pComPort = FindPort(szDevice, sizeof(szDevice), bScan);
+		if (!pComPort || !(pRunRom || pManifest))
+		{
+			return 0;
+		}
 	}
 
 	// see if we have enough to go on
 
-	if (!(pComPort && pRunRom))
+	if (!(pComPort && (pRunRom || pManifest)))
 	{
 		Usage(argv[0]);
 		return 0;
 	}
 
-	FILE *f = 0;
+	RomStream rom;
 	COMPORT com = COMPORT_INVALID;
+	SCmdTimes timesStart;
 	do
 	{
-		// try and connect to the 7800GD
-		com = CmdInit(pComPort);
+		// connect to the 7800GD on another thread while the ROM is opened,
+		// the break waits until the ROM is known to be good
+		CmdGetTimes(&timesStart);
+		std::promise<bool> romValid;
+		std::shared_future<bool> romReady = romValid.get_future().share();
+		std::future<SHandshake> handshake = std::async(std::launch::async, Handshake, pComPort, romReady, bCachedPort);
+
+		// manifest uploads separate segments rather than a rom
+		SManifest manifest;
+		u8 header[A78_HEADER_SIZE];
+		GDMapperInfo mapper;
+		bool bValid;
+		if (pManifest)
+		{
+			bValid = ManifestLoad(&manifest, pManifest);
+		}
+		else if (!rom.Open(pRunRom))
+		{
+			printf("Unable to open '%s' (%s)...\n", pRunRom, rom.GetError());
+			bValid = false;
+		}
+		else
+		{
+			// see if the file looks valid
+			bValid = rom.Read(header, sizeof(header)) == sizeof(header) && Get7800Mapper(&mapper, header);
+			if (!bValid && rom.GetError())
+			{
+				printf("File is not valid '%s' (%s)...\n", pRunRom, rom.GetError());
+			}
+			else if (!bValid)
+			{
+				printf("File is not valid '%s'...\n", pRunRom);
+			}
+		}
+		romValid.set_value(bValid);
+		u64 nRomMs = GetTickCount64();
+
+		SHandshake hs = handshake.get();
+
+		// cached port didn't answer, look for the 7800GD on all ports
+		if (bCachedPort && !hs.bFound)
+		{
+			if (hs.com != COMPORT_INVALID)
+			{
+				CmdTerm(hs.com);
+			}
+			pComPort = FindPort(szDevice, sizeof(szDevice), false);
+			if (!pComPort)
+			{
+				break;
+			}
+			hs = Handshake(pComPort, romReady, false);
+		}
+
+		com = hs.com;
 		if (com == COMPORT_INVALID)
 		{
 			printf("Unable to open '%s'...\n", pComPort);
 			break;
 		}
 
-		// now try and open the file
-		if (fopen_s(&f, pRunRom, "rb") != 0)
+		if (!bValid || !hs.bReady)
 		{
-			printf("Unable to open '%s'...\n", pRunRom);
 			break;
 		}
 
-		// see if the file looks valid
-		GDMapperInfo mapper;
-		if (!Get7800Mapper(&mapper, f))
+		// the first write goes out as soon as both sides are ready
+		if (!bSoak && !bExecOnly)
 		{
-			printf("File is not valid '%s'...\n", pRunRom);
+			printf("First byte after %dms (port %dms, rom %dms)\n",
+				(int)(GetTickCount64() - nLaunchMs), (int)(hs.nReadyMs - nLaunchMs), (int)(nRomMs - nLaunchMs));
+		}
+
+		if (pManifest)
+		{
+			RunManifest(com, hs.status, manifest, pComPort, pManifest, bFull, &sAudio, &sIRQ, &sExtra, nDelay);
 			break;
 		}
 
-		// all good, lets make sure we're in a state to upload (menu or in break)
-		E7800Status status;
-		if (CmdStatus(com, &status))
+		// soak test works from the image in memory
+		if (bSoak)
 		{
-			if (status == EStatus_Running)
+			u32 nImageSize = mapper.nSize * (IsBankset(&mapper) ? 2 : 1);
+			std::vector<u8> image(nImageSize);
+			if (rom.Read(image.data(), nImageSize) != nImageSize || !rom.Finish())
 			{
-				if (!CmdBreak(com))
-				{
-					printf("Unable to break.\n");
-					break;
-				}
+				printf("File is not valid '%s' (%s)...\n", pRunRom, rom.GetError());
+				break;
 			}
+			ManifestForgetPort(pComPort);
+			Soak(com, &mapper, image.data(), &soak);
+			break;
 		}
-		else
+
+		// execute only reuses the image already uploaded
+		if (bExecOnly)
 		{
-			printf("Unable to get status.\n");
+			ExecuteVariants(com, &mapper, &sAudio, &sIRQ, &sExtra, true, nDelay);
 			break;
 		}
 
-		// now upload, bankset has two sections
-		if (UploadToCart(com, f, 0x80, mapper.nLoadAddr, mapper.nSize)
-			&& (!IsBankset(&mapper) || UploadToCart(com, f, 0x80 + mapper.nSize, mapper.nLoadAddr | 0x80000, mapper.nSize)))
+		// now upload, bankset has two sections one after the other. Any
+		// manifest previously sent to this port is overwritten.
+		ManifestForgetPort(pComPort);
+		if (UploadToCart(com, &rom, 0, mapper.nLoadAddr, mapper.nSize)
+			&& (!IsBankset(&mapper) || UploadToCart(com, &rom, 0, mapper.nLoadAddr | 0x80000, mapper.nSize)))
 		{
-			// setup and execute with given mapper details
-			if (CmdExecute(	com,
-							mapper.nMapper,
-							mapper.nMapperOptions,
-							mapper.nMapperAudio,
-							mapper.nMapperIRQEnable,
-							mapper.nSize,
-							mapper.nExtraFlags))
+			// archive data is only known good once it's all been read
+			if (!rom.Finish())
 			{
-				printf("Executing...\n");
-			}
-			else
-			{
-				printf("Unable to execute.\n");
+				printf("File is not valid '%s' (%s)...\n", pRunRom, rom.GetError());
+				break;
 			}
+
+			// setup and execute with given mapper details
+			ExecuteVariants(com, &mapper, &sAudio, &sIRQ, &sExtra, true, nDelay);
 		}
 	}
 	while(0);
 	
-	if (com != COMPORT_INVALID) CmdTerm(com);
-	if (f) fclose(f);
+	if (com != COMPORT_INVALID)
+	{
+		// soak keeps its own statistics
+		if (!bSoak)
+		{
+			ReportRun(pComPort, &timesStart);
+		}
+		CmdTerm(com);
+	}
+	rom.Close();
+
+	if (bStats)
+	{
+		SComStats stats;
+		ComGetStats(&stats);
+		printf("Serial: %d breaks, %d writes (%d bytes), %d reads (%d bytes)\n",
+			stats.nBreaks, stats.nWrites, stats.nBytesWritten, stats.nReads, stats.nBytesRead);
+	}
 
 	return 0;
 }
\ No newline at end of file
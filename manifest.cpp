@@ -0,0 +1,386 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <future>
+#include "manifest.h"
+#include "inflate.h"
+#include "scan.h"
+
+// Split a line into whitespace separated tokens, quotes allow spaces in file
+// names and # starts a comment
+
+static int ManifestTokens(char *pLine, char **pTokens, int nMax)
+{
+	int nCount = 0;
+	while (*pLine && nCount < nMax)
+	{
+		while (*pLine == ' ' || *pLine == '\t' || *pLine == '\r' || *pLine == '\n')
+		{
+			pLine++;
+		}
+		if (*pLine == 0 || *pLine == '#')
+		{
+			break;
+		}
+
+		char cEnd = ' ';
+		if (*pLine == '"')
+		{
+			cEnd = '"';
+			pLine++;
+		}
+
+		pTokens[nCount++] = pLine;
+		while (*pLine && *pLine != cEnd && !(cEnd == ' ' && (*pLine == '\t' || *pLine == '\r' || *pLine == '\n')))
+		{
+			pLine++;
+		}
+		if (*pLine)
+		{
+			*pLine++ = 0;
+		}
+	}
+	return nCount;
+}
+
+static bool ManifestValue(const char *pText, u32 *pValue)
+{
+	// a number must follow the $ prefix
+	bool bHex = (*pText == '$');
+	const char *pDigits = bHex ? pText + 1 : pText;
+	if (!(bHex ? isxdigit((u8)*pDigits) : isdigit((u8)*pDigits)))
+	{
+		return false;
+	}
+
+	char *pEnd;
+	*pValue = strtoul(pDigits, &pEnd, bHex ? 16 : 0);
+	return *pEnd == 0;
+}
+
+static bool ManifestMapper(const char *pText, u32 *pValue)
+{
+	static const char *pNames[] = { "linear", "supergame", "activision", "absolute", "souper" };
+	for (u32 n = 0; n < COUNTOF(pNames); n++)
+	{
+		if (_stricmp(pText, pNames[n]) == 0)
+		{
+			*pValue = n;
+			return true;
+		}
+	}
+	return ManifestValue(pText, pValue);
+}
+
+// Read a segment file from the given offset to the end
+
+static bool ManifestReadSegment(SManifestSegment *pSegment, std::string path)
+{
+	FILE *f;
+	if (fopen_s(&f, path.c_str(), "rb") != 0)
+	{
+		return false;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long nSize = ftell(f);
+	bool bOk = nSize >= (long)pSegment->nOffset;
+	if (bOk)
+	{
+		pSegment->data.resize(nSize - pSegment->nOffset);
+		fseek(f, pSegment->nOffset, SEEK_SET);
+		bOk = fread(pSegment->data.data(), 1, pSegment->data.size(), f) == pSegment->data.size();
+		pSegment->nCRC = Crc32(0, pSegment->data.data(), (u32)pSegment->data.size());
+	}
+
+	fclose(f);
+	return bOk;
+}
+
+// Parse the manifest and read all the segment files, the files are read at
+// the same time as they are usually separate build outputs
+
+bool ManifestLoad(SManifest *pManifest, const char *pPath)
+{
+	FILE *f;
+	if (fopen_s(&f, pPath, "r") != 0)
+	{
+		printf("Unable to open '%s'...\n", pPath);
+		return false;
+	}
+
+	// segment files are relative to the manifest
+	std::string dir(pPath);
+	size_t nSlash = dir.find_last_of("/\\:");
+	dir = (nSlash == std::string::npos) ? "" : dir.substr(0, nSlash + 1);
+
+	GDMapperInfo *pMapper = &pManifest->mapper;
+	memset(pMapper, 0, sizeof(*pMapper));
+	pManifest->segments.clear();
+
+	u32 nSize = 0;
+	bool bOk = true;
+	int nLine = 0;
+	char szLine[512];
+	while (bOk && fgets(szLine, sizeof(szLine), f))
+	{
+		nLine++;
+
+		char *pTokens[8];
+		int nTokens = ManifestTokens(szLine, pTokens, COUNTOF(pTokens));
+		if (nTokens == 0)
+		{
+			continue;
+		}
+
+		u32 nValue = 0;
+		if (_stricmp(pTokens[0], "segment") == 0 && (nTokens == 4 || (nTokens == 5 && _stricmp(pTokens[4], "bankset") == 0)))
+		{
+			SManifestSegment segment;
+			segment.file = pTokens[1];
+			segment.bBankset = nTokens == 5;
+			segment.nCRC = 0;
+			segment.bChanged = true;
+			bOk = ManifestValue(pTokens[2], &segment.nOffset) && ManifestValue(pTokens[3], &segment.nAddr);
+			segment.nAddr |= segment.bBankset ? 0x80000 : 0;
+			pManifest->segments.push_back(segment);
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "mapper") == 0)
+		{
+			bOk = ManifestMapper(pTokens[1], &nValue) && nValue <= 0xff;
+			pMapper->nMapper = (u8)nValue;
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "options") == 0)
+		{
+			bOk = ManifestValue(pTokens[1], &nValue) && nValue <= 0xff;
+			pMapper->nMapperOptions = (u8)nValue;
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "audio") == 0)
+		{
+			bOk = ManifestValue(pTokens[1], &nValue) && nValue <= 0xffff;
+			pMapper->nMapperAudio = (u16)nValue;
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "irq") == 0)
+		{
+			bOk = ManifestValue(pTokens[1], &nValue) && nValue <= 0xffff;
+			pMapper->nMapperIRQEnable = (u16)nValue;
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "extra") == 0)
+		{
+			bOk = ManifestValue(pTokens[1], &nValue) && nValue <= 0xff;
+			pMapper->nExtraFlags = (u8)nValue;
+		}
+		else if (nTokens == 2 && _stricmp(pTokens[0], "size") == 0)
+		{
+			bOk = ManifestValue(pTokens[1], &nSize);
+		}
+		else
+		{
+			bOk = false;
+		}
+
+		if (!bOk)
+		{
+			printf("%s(%d): invalid line...\n", pPath, nLine);
+		}
+	}
+	fclose(f);
+
+	if (!bOk)
+	{
+		return false;
+	}
+	if (pManifest->segments.empty())
+	{
+		printf("%s: no segments...\n", pPath);
+		return false;
+	}
+
+	// read all segment files at once
+	std::vector<std::future<bool>> reads;
+	for (SManifestSegment &segment : pManifest->segments)
+	{
+		reads.push_back(std::async(std::launch::async, ManifestReadSegment, &segment, dir + segment.file));
+	}
+	for (size_t n = 0; n < reads.size(); n++)
+	{
+		if (!reads[n].get())
+		{
+			printf("Unable to read '%s'...\n", pManifest->segments[n].file.c_str());
+			bOk = false;
+		}
+	}
+	if (!bOk)
+	{
+		return false;
+	}
+
+	std::stable_sort(pManifest->segments.begin(), pManifest->segments.end(),
+		[](const SManifestSegment &a, const SManifestSegment &b) { return a.nAddr < b.nAddr; });
+
+	// execute size defaults to the span of the first bankset half
+	u32 nStart = 0xffffffff, nEnd = 0;
+	for (const SManifestSegment &segment : pManifest->segments)
+	{
+		if (!segment.bBankset)
+		{
+			nStart = segment.nAddr < nStart ? segment.nAddr : nStart;
+			nEnd = segment.nAddr + (u32)segment.data.size() > nEnd ? segment.nAddr + (u32)segment.data.size() : nEnd;
+		}
+	}
+	pMapper->nSize = nSize ? nSize : (nEnd > nStart ? nEnd - nStart : 0);
+	pMapper->nLoadAddr = nStart == 0xffffffff ? 0 : nStart;
+
+	return true;
+}
+
+// The cache records what was last sent to which port, a segment only needs
+// sending again if its address, size or contents changed
+
+static std::string ManifestCachePath(const char *pPath)
+{
+	return std::string(pPath) + ".cache";
+}
+
+// The cart only holds whatever was uploaded to it last, so each port records
+// which manifest that was. Any other upload to the port forgets it and the
+// manifest cache no longer applies.
+
+static void ManifestSetLast(const char *pPort, const char *pPath)
+{
+	char szConfig[MAX_PATH + 16];
+	ScanConfigPath(szConfig, sizeof(szConfig), "7800cmd.last");
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	std::string lines;
+
+	FILE *f;
+	if (fopen_s(&f, szConfig, "r") == 0)
+	{
+		char szLine[MAX_PATH + 80];
+		while (fgets(szLine, sizeof(szLine), f))
+		{
+			size_t nKey = strcspn(szLine, " \r\n");
+			if (nKey != strlen(szKey) || strncmp(szLine, szKey, nKey) != 0)
+			{
+				lines += szLine;
+			}
+		}
+		fclose(f);
+	}
+
+	char szFull[MAX_PATH];
+	if (pPath && _fullpath(szFull, pPath, sizeof(szFull)))
+	{
+		lines += std::string(szKey) + " " + szFull + "\n";
+	}
+
+	if (fopen_s(&f, szConfig, "w") == 0)
+	{
+		fputs(lines.c_str(), f);
+		fclose(f);
+	}
+}
+
+static bool ManifestIsLast(const char *pPort, const char *pPath)
+{
+	char szConfig[MAX_PATH + 16];
+	ScanConfigPath(szConfig, sizeof(szConfig), "7800cmd.last");
+
+	char szKey[64], szFull[MAX_PATH];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	if (!_fullpath(szFull, pPath, sizeof(szFull)))
+	{
+		return false;
+	}
+
+	FILE *f;
+	if (fopen_s(&f, szConfig, "r") != 0)
+	{
+		return false;
+	}
+
+	bool bLast = false;
+	char szLine[MAX_PATH + 80];
+	while (!bLast && fgets(szLine, sizeof(szLine), f))
+	{
+		szLine[strcspn(szLine, "\r\n")] = 0;
+		size_t nKey = strlen(szKey);
+		bLast = strncmp(szLine, szKey, nKey) == 0 && szLine[nKey] == ' ' && _stricmp(szLine + nKey + 1, szFull) == 0;
+	}
+
+	fclose(f);
+	return bLast;
+}
+
+void ManifestForgetPort(const char *pPort)
+{
+	ManifestSetLast(pPort, 0);
+}
+
+void ManifestCompare(SManifest *pManifest, const char *pPath, const char *pPort)
+{
+	if (!ManifestIsLast(pPort, pPath))
+	{
+		return;
+	}
+
+	FILE *f;
+	if (fopen_s(&f, ManifestCachePath(pPath).c_str(), "r") != 0)
+	{
+		return;
+	}
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+
+	char szLine[512];
+	char *pTokens[4];
+	bool bSamePort = fgets(szLine, sizeof(szLine), f) && ManifestTokens(szLine, pTokens, 4) == 2
+		&& _stricmp(pTokens[0], "port") == 0 && strcmp(pTokens[1], szKey) == 0;
+
+	while (bSamePort && fgets(szLine, sizeof(szLine), f))
+	{
+		u32 nAddr, nSize, nCRC;
+		if (ManifestTokens(szLine, pTokens, 4) == 4 && ManifestValue(pTokens[1], &nAddr) && ManifestValue(pTokens[2], &nSize) && ManifestValue(pTokens[3], &nCRC))
+		{
+			for (SManifestSegment &segment : pManifest->segments)
+			{
+				if (segment.nAddr == nAddr && segment.data.size() == nSize && segment.nCRC == nCRC)
+				{
+					segment.bChanged = false;
+				}
+			}
+		}
+	}
+
+	fclose(f);
+}
+
+void ManifestClearCache(const char *pPath)
+{
+	remove(ManifestCachePath(pPath).c_str());
+}
+
+void ManifestSaveCache(const SManifest *pManifest, const char *pPath, const char *pPort)
+{
+	FILE *f;
+	if (fopen_s(&f, ManifestCachePath(pPath).c_str(), "w") != 0)
+	{
+		return;
+	}
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	fprintf(f, "port \"%s\"\n", szKey);
+	for (const SManifestSegment &segment : pManifest->segments)
+	{
+		fprintf(f, "segment 0x%05x 0x%x 0x%08x\n", segment.nAddr, (u32)segment.data.size(), segment.nCRC);
+	}
+	fclose(f);
+
+	ManifestSetLast(pPort, pPath);
+}
@@ -0,0 +1,45 @@
+#ifndef __7800CMD_MANIFEST__
+#define __7800CMD_MANIFEST__
+
+#include <string>
+#include <vector>
+#include "mapper.h"
+
+// Manifest describing a ROM built as separate segments, uploaded directly
+// rather than being joined into an .a78 first
+//
+//	mapper supergame			linear, supergame, activision, absolute, souper or number
+//	options 0x80				mapper options, $80 is bankset
+//	audio 0x0001				V4 audio
+//	irq 0x0001					V4 IRQ enable
+//	extra 0x0008				execute extra flags
+//	size 0x20000				optional, size passed to execute (per bankset half)
+//	segment code.bin 0 0x00000	file, file offset, cart address
+//	segment maria.bin 0 0x00000 bankset
+//
+// Files are relative to the manifest, # starts a comment.
+
+struct SManifestSegment
+{
+	std::string			file;
+	u32					nOffset;
+	u32					nAddr;				// cart address, bankset segments include $80000
+	bool				bBankset;
+	std::vector<u8>		data;
+	u32					nCRC;
+	bool				bChanged;
+};
+
+struct SManifest
+{
+	GDMapperInfo					mapper;
+	std::vector<SManifestSegment>	segments;		// in address order
+};
+
+bool ManifestLoad(SManifest *pManifest, const char *pPath);
+void ManifestCompare(SManifest *pManifest, const char *pPath, const char *pPort);
+void ManifestClearCache(const char *pPath);
+void ManifestSaveCache(const SManifest *pManifest, const char *pPath, const char *pPort);
+void ManifestForgetPort(const char *pPort);
+
+#endif // __7800CMD_MANIFEST__
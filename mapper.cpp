@@ -92,13 +92,12 @@ static u16 EndianSwapWord(u16 nWord)
 			((nWord & 0x000000ff) << 8);
 }
 
-bool Get7800Mapper(GDMapperInfo *pMapper, FILE *pFile)
+bool Get7800Mapper(GDMapperInfo *pMapper, const u8 *pHeader)
 {
-	// Read in the header from the open file
+	// Copy in the header read from the file
 	A78Header sHeader;
-	fseek(pFile, 0, SEEK_SET);
-	fread(&sHeader.nVersion, 1, 1, pFile);				// version first such that the rest is aligned
-	fread(&sHeader, 1, sizeof(sHeader) - 1, pFile);
+	sHeader.nVersion = pHeader[0];						// version first such that the rest is aligned
+	memcpy(&sHeader, pHeader + 1, sizeof(sHeader) - 1);
 
 	// Check the header magic is there
 	StripTrailingSpaces(sHeader.szMagic, sizeof(sHeader.szMagic));
@@ -376,4 +375,11 @@ bool Get7800Mapper(GDMapperInfo *pMapper, FILE *pFile)
 	pMapper->nSize = sHeader.nSize;
 
 	return true;
-}
\ No newline at end of file
+}
+
+// Bankset images are loaded as two halves, the second at load address | $80000
+
+bool IsBankset(const GDMapperInfo *pInfo)
+{
+	return ((pInfo->nMapper == EA78_V4_MAPPER_LINEAR || pInfo->nMapper == EA78_V4_MAPPER_SUPERGAME) && (pInfo->nMapperOptions & EA78_V4_MAPPER_LINEAR_BANKSET));
+}
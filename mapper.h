@@ -66,6 +66,9 @@ struct GDMapperInfo
 	u8		nExtraFlags;
 };
 
-bool Get7800Mapper(GDMapperInfo *pMapper, FILE *pFile);
+static const u32 A78_HEADER_SIZE = 0x80;
+
+bool Get7800Mapper(GDMapperInfo *pMapper, const u8 *pHeader);
+bool IsBankset(const GDMapperInfo *pInfo);
 
 #endif // __7800_MAPPER_H__
\ No newline at end of file
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "plan.h"
+#include "scan.h"
+
+// Uncalibrated model, 500000 baud with typical USB serial latency
+
+static const SPlanModel s_defaultModel = { 48000.0f, 3.0f, 4.0f, 1.0f, 0 };
+
+static const char *s_pPlanCmdName[ECmdTime_Count] = { "status", "break", "return", "writecart", "data", "complete", "execute" };
+
+void PlanLoadModel(SPlanModel *pModel, const char *pPort)
+{
+	*pModel = s_defaultModel;
+
+	char szPath[MAX_PATH + 16];
+	ScanConfigPath(szPath, sizeof(szPath), "7800cmd.model");
+
+	FILE *f;
+	if (fopen_s(&f, szPath, "r") != 0)
+	{
+		return;
+	}
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	char szLine[256];
+	while (fgets(szLine, sizeof(szLine), f))
+	{
+		char szLineKey[64];
+		SPlanModel model;
+		if (sscanf_s(szLine, "%63s %f %f %f %f %u", szLineKey, (unsigned)sizeof(szLineKey), &model.fBytesPerSec, &model.fCommandMs, &model.fBreakMs, &model.fCompleteMs, &model.nRuns) == 6
+			&& strcmp(szKey, szLineKey) == 0 && model.fBytesPerSec > 0.0f)
+		{
+			*pModel = model;
+		}
+	}
+
+	fclose(f);
+}
+
+// Rewrite the model file replacing the line for this port
+
+void PlanSaveModel(const SPlanModel *pModel, const char *pPort)
+{
+	char szPath[MAX_PATH + 16];
+	ScanConfigPath(szPath, sizeof(szPath), "7800cmd.model");
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	std::string lines;
+
+	FILE *f;
+	if (fopen_s(&f, szPath, "r") == 0)
+	{
+		char szLine[256];
+		while (fgets(szLine, sizeof(szLine), f))
+		{
+			char szLineKey[64];
+			if (sscanf_s(szLine, "%63s", szLineKey, (unsigned)sizeof(szLineKey)) == 1 && strcmp(szKey, szLineKey) != 0)
+			{
+				lines += szLine;
+			}
+		}
+		fclose(f);
+	}
+
+	if (fopen_s(&f, szPath, "w") == 0)
+	{
+		fputs(lines.c_str(), f);
+		fprintf(f, "%s %.1f %.3f %.3f %.3f %u\n", szKey, pModel->fBytesPerSec, pModel->fCommandMs, pModel->fBreakMs, pModel->fCompleteMs, pModel->nRuns);
+		fclose(f);
+	}
+}
+
+void PlanAdd(std::vector<SPlanStep> *pPlan, ECmdTime cmd, bool bOptional)
+{
+	SPlanStep step = { cmd, 0, 0, bOptional };
+	pPlan->push_back(step);
+}
+
+// Upload is the write cart command, the data and waiting for completion
+
+void PlanAddUpload(std::vector<SPlanStep> *pPlan, u32 nAddr, u32 nSize)
+{
+	SPlanStep cart = { ECmdTime_WriteCart, nAddr, nSize, false };
+	SPlanStep data = { ECmdTime_WriteData, nAddr, nSize, false };
+	SPlanStep complete = { ECmdTime_WriteDataComplete, nAddr, nSize, false };
+	pPlan->push_back(cart);
+	pPlan->push_back(data);
+	pPlan->push_back(complete);
+}
+
+static float PlanStepMs(const SPlanModel *pModel, ECmdTime cmd, u64 nBytes)
+{
+	switch (cmd)
+	{
+		case ECmdTime_Break:				return pModel->fBreakMs;
+		case ECmdTime_WriteData:			return (nBytes * 1000.0f) / pModel->fBytesPerSec;
+		case ECmdTime_WriteDataComplete:	return pModel->fCompleteMs;
+		default:							return pModel->fCommandMs;
+	}
+}
+
+// Print the plan with the estimate for each step, optional steps are counted
+// so the estimate is the worst case. Returns the estimate in ms.
+
+float PlanPrint(const std::vector<SPlanStep> *pPlan, const SPlanModel *pModel, const char *pPort)
+{
+	float fTotalMs = 0.0f;
+	for (const SPlanStep &step : *pPlan)
+	{
+		float fMs = PlanStepMs(pModel, step.cmd, step.nSize);
+		fTotalMs += fMs;
+
+		char szStep[64];
+		if (step.cmd == ECmdTime_WriteCart)
+		{
+			sprintf_s(szStep, sizeof(szStep), "%s $%05x %dK", s_pPlanCmdName[step.cmd], step.nAddr, step.nSize / 1024);
+		}
+		else if (step.cmd == ECmdTime_WriteData)
+		{
+			sprintf_s(szStep, sizeof(szStep), "%s %d bytes", s_pPlanCmdName[step.cmd], step.nSize);
+		}
+		else
+		{
+			sprintf_s(szStep, sizeof(szStep), "%s%s", s_pPlanCmdName[step.cmd], step.bOptional ? " (if running)" : "");
+		}
+		printf("  %-32s %9.1fms\n", szStep, fMs);
+	}
+
+	char szKey[64];
+	ScanPortKey(szKey, sizeof(szKey), pPort);
+	printf("Estimated %.2fs on %s (%.1fKB/s, command %.1fms, break %.1fms, complete %.1fms, from %d runs)\n",
+		fTotalMs / 1000.0f, szKey, pModel->fBytesPerSec / 1024.0f,
+		pModel->fCommandMs, pModel->fBreakMs, pModel->fCompleteMs, pModel->nRuns);
+
+	return fTotalMs;
+}
+
+void PlanDelta(SCmdTimes *pRun, const SCmdTimes *pBefore, const SCmdTimes *pAfter)
+{
+	for (int n = 0; n < ECmdTime_Count; n++)
+	{
+		pRun->nCount[n] = pAfter->nCount[n] - pBefore->nCount[n];
+		pRun->nTimeUs[n] = pAfter->nTimeUs[n] - pBefore->nTimeUs[n];
+	}
+	pRun->nDataBytes = pAfter->nDataBytes - pBefore->nDataBytes;
+}
+
+// Estimate for the commands a run actually made, so a break that wasn't
+// needed doesn't count against the model
+
+float PlanEstimate(const SPlanModel *pModel, const SCmdTimes *pRun)
+{
+	float fMs = PlanStepMs(pModel, ECmdTime_WriteData, pRun->nDataBytes);
+	for (int n = 0; n < ECmdTime_Count; n++)
+	{
+		if (n != ECmdTime_WriteData)
+		{
+			fMs += pRun->nCount[n] * PlanStepMs(pModel, (ECmdTime)n, 0);
+		}
+	}
+	return fMs;
+}
+
+// Blend in the measurements from a run, early runs have more weight so the
+// model settles quickly, later runs still move it so drift is followed
+
+static void PlanBlend(float *pValue, float fMeasured, float fWeight)
+{
+	*pValue += (fMeasured - *pValue) * fWeight;
+}
+
+void PlanCalibrate(SPlanModel *pModel, const SCmdTimes *pRun)
+{
+	float fWeight = 1.0f / (pModel->nRuns + 1);
+	fWeight = fWeight < 0.25f ? 0.25f : fWeight;
+
+	u32 nCommands = 0;
+	u64 nCommandUs = 0;
+	for (ECmdTime cmd : { ECmdTime_Status, ECmdTime_Return, ECmdTime_WriteCart, ECmdTime_Execute })
+	{
+		nCommands += pRun->nCount[cmd];
+		nCommandUs += pRun->nTimeUs[cmd];
+	}
+
+	if (nCommands)
+	{
+		PlanBlend(&pModel->fCommandMs, nCommandUs / (nCommands * 1000.0f), fWeight);
+	}
+	if (pRun->nCount[ECmdTime_Break])
+	{
+		PlanBlend(&pModel->fBreakMs, pRun->nTimeUs[ECmdTime_Break] / (pRun->nCount[ECmdTime_Break] * 1000.0f), fWeight);
+	}
+	if (pRun->nCount[ECmdTime_WriteDataComplete])
+	{
+		PlanBlend(&pModel->fCompleteMs, pRun->nTimeUs[ECmdTime_WriteDataComplete] / (pRun->nCount[ECmdTime_WriteDataComplete] * 1000.0f), fWeight);
+	}
+	if (pRun->nDataBytes && pRun->nTimeUs[ECmdTime_WriteData])
+	{
+		PlanBlend(&pModel->fBytesPerSec, (pRun->nDataBytes * 1000000.0f) / pRun->nTimeUs[ECmdTime_WriteData], fWeight);
+	}
+
+	pModel->nRuns++;
+}
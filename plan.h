@@ -0,0 +1,39 @@
+#ifndef __7800CMD_PLAN__
+#define __7800CMD_PLAN__
+
+#include <vector>
+#include "7800cmd.h"
+
+// Upload cost model for a device, calibrated from real runs
+
+struct SPlanModel
+{
+	float	fBytesPerSec;			// data rate while uploading
+	float	fCommandMs;				// round trip for status, write cart, return and execute
+	float	fBreakMs;				// break of a running program
+	float	fCompleteMs;			// wait for write completion after the data
+	u32		nRuns;					// number of runs calibrated from
+};
+
+// Step of an upload plan, optional steps only happen if the cart is running
+
+struct SPlanStep
+{
+	ECmdTime	cmd;
+	u32			nAddr;
+	u32			nSize;
+	bool		bOptional;
+};
+
+void PlanLoadModel(SPlanModel *pModel, const char *pPort);
+void PlanSaveModel(const SPlanModel *pModel, const char *pPort);
+
+void PlanAdd(std::vector<SPlanStep> *pPlan, ECmdTime cmd, bool bOptional = false);
+void PlanAddUpload(std::vector<SPlanStep> *pPlan, u32 nAddr, u32 nSize);
+float PlanPrint(const std::vector<SPlanStep> *pPlan, const SPlanModel *pModel, const char *pPort);
+
+void PlanDelta(SCmdTimes *pRun, const SCmdTimes *pBefore, const SCmdTimes *pAfter);
+float PlanEstimate(const SPlanModel *pModel, const SCmdTimes *pRun);
+void PlanCalibrate(SPlanModel *pModel, const SCmdTimes *pRun);
+
+#endif // __7800CMD_PLAN__
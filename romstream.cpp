@@ -0,0 +1,387 @@
+#include <string.h>
+#include "romstream.h"
+#include "inflate.h"
+
+// Read ahead is limited so large archives don't end up entirely in memory
+
+static const u32 ROMSTREAM_CHUNK = 16384;
+static const u32 ROMSTREAM_MAX_CHUNKS = 64;
+
+static u16 RomGet16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 RomGet32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+// Case insensitive search, used to split archive and entry names
+
+static const char *RomFindNoCase(const char *pText, const char *pFind)
+{
+	size_t nLen = strlen(pFind);
+	for (; *pText; pText++)
+	{
+		if (_strnicmp(pText, pFind, nLen) == 0)
+		{
+			return pText;
+		}
+	}
+	return 0;
+}
+
+// Zip names compare ignoring case and path separator style
+
+static bool RomNameMatch(const char *pName, u32 nNameLen, const char *pEntry)
+{
+	if (strlen(pEntry) != nNameLen)
+	{
+		return false;
+	}
+
+	for (u32 n = 0; n < nNameLen; n++)
+	{
+		char a = pName[n] == '\\' ? '/' : pName[n];
+		char b = pEntry[n] == '\\' ? '/' : pEntry[n];
+		if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+		if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+		if (a != b)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+RomStream::RomStream()
+	: m_pFile(0), m_format(EFormat_Plain), m_nCompressedSize(0), m_nCRC(0), m_pError(0),
+	  m_nChunkPos(0), m_bDone(false), m_bFailed(false), m_bStop(false)
+{
+}
+
+RomStream::~RomStream()
+{
+	Close();
+}
+
+bool RomStream::Open(const char *pPath)
+{
+	Close();
+	m_pError = 0;
+
+	// archive entries are given as archive.zip:entry
+	const char *pSplit = RomFindNoCase(pPath, ".zip:");
+	if (pSplit)
+	{
+		std::string archive(pPath, pSplit + 4);
+		if (!OpenZip(archive.c_str(), pSplit + 5))
+		{
+			Close();
+			return false;
+		}
+	}
+	else if (RomFindNoCase(pPath, ".7z:"))
+	{
+		m_pError = "7z archives are not supported";
+		return false;
+	}
+	else
+	{
+		if (fopen_s(&m_pFile, pPath, "rb") != 0)
+		{
+			m_pFile = 0;
+			m_pError = "unable to open file";
+			return false;
+		}
+
+		size_t nLen = strlen(pPath);
+		if (nLen > 3 && _stricmp(pPath + nLen - 3, ".gz") == 0 && !OpenGzip())
+		{
+			Close();
+			return false;
+		}
+	}
+
+	m_thread = std::thread(&RomStream::Producer, this);
+	return true;
+}
+
+// Find the entry through the central directory as local headers may not
+// have the sizes filled in
+
+bool RomStream::OpenZip(const char *pArchive, const char *pEntry)
+{
+	if (fopen_s(&m_pFile, pArchive, "rb") != 0)
+	{
+		m_pFile = 0;
+		m_pError = "unable to open archive";
+		return false;
+	}
+
+	// end of central directory record is in the last 64K + 22 bytes
+	fseek(m_pFile, 0, SEEK_END);
+	long nFileSize = ftell(m_pFile);
+	long nTail = nFileSize < 65557 ? nFileSize : 65557;
+	std::vector<u8> tail(nTail);
+	fseek(m_pFile, nFileSize - nTail, SEEK_SET);
+	if (fread(tail.data(), 1, nTail, m_pFile) != (size_t)nTail)
+	{
+		m_pError = "unable to read archive";
+		return false;
+	}
+
+	long nEnd = nTail - 22;
+	while (nEnd >= 0 && RomGet32(&tail[nEnd]) != 0x06054b50)
+	{
+		nEnd--;
+	}
+	if (nEnd < 0)
+	{
+		m_pError = "not a zip archive";
+		return false;
+	}
+
+	u32 nEntries = RomGet16(&tail[nEnd + 10]);
+	u32 nDirSize = RomGet32(&tail[nEnd + 12]);
+	u32 nDirOffset = RomGet32(&tail[nEnd + 16]);
+
+	std::vector<u8> dir(nDirSize);
+	fseek(m_pFile, nDirOffset, SEEK_SET);
+	if (fread(dir.data(), 1, nDirSize, m_pFile) != nDirSize)
+	{
+		m_pError = "unable to read archive";
+		return false;
+	}
+
+	// walk the central directory for the entry
+	u32 nPos = 0;
+	for (u32 n = 0; n < nEntries && nPos + 46 <= nDirSize; n++)
+	{
+		const u8 *p = &dir[nPos];
+		if (RomGet32(p) != 0x02014b50)
+		{
+			break;
+		}
+
+		u32 nNameLen = RomGet16(p + 28);
+		if (nPos + 46 + nNameLen <= nDirSize && RomNameMatch((const char *)p + 46, nNameLen, pEntry))
+		{
+			u16 nFlags = RomGet16(p + 8);
+			u16 nMethod = RomGet16(p + 10);
+			if ((nFlags & 1) || (nMethod != 0 && nMethod != 8))
+			{
+				m_pError = "unsupported zip compression";
+				return false;
+			}
+
+			m_format = nMethod ? EFormat_Deflate : EFormat_Stored;
+			m_nCRC = RomGet32(p + 16);
+			m_nCompressedSize = RomGet32(p + 20);
+
+			// skip over the local header to the data
+			u8 local[30];
+			fseek(m_pFile, RomGet32(p + 42), SEEK_SET);
+			if (fread(local, 1, sizeof(local), m_pFile) != sizeof(local) || RomGet32(local) != 0x04034b50)
+			{
+				m_pError = "corrupt zip archive";
+				return false;
+			}
+			fseek(m_pFile, RomGet16(local + 26) + RomGet16(local + 28), SEEK_CUR);
+			return true;
+		}
+
+		nPos += 46 + nNameLen + RomGet16(p + 30) + RomGet16(p + 32);
+	}
+
+	m_pError = "entry not found in archive";
+	return false;
+}
+
+// Single member gzip, CRC and size are in the trailer
+
+bool RomStream::OpenGzip()
+{
+	u8 header[10];
+	if (fread(header, 1, sizeof(header), m_pFile) != sizeof(header) || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8)
+	{
+		m_pError = "not a gzip file";
+		return false;
+	}
+
+	// optional header fields
+	u8 nFlags = header[3];
+	if (nFlags & 4)
+	{
+		u8 extra[2];
+		fread(extra, 1, 2, m_pFile);
+		fseek(m_pFile, RomGet16(extra), SEEK_CUR);
+	}
+	for (u8 nString = 8; nString <= 16; nString <<= 1)
+	{
+		if (nFlags & nString)
+		{
+			int c;
+			while ((c = fgetc(m_pFile)) != EOF && c != 0);
+		}
+	}
+	if (nFlags & 2)
+	{
+		fseek(m_pFile, 2, SEEK_CUR);
+	}
+
+	long nStart = ftell(m_pFile);
+	u8 trailer[8];
+	fseek(m_pFile, -8, SEEK_END);
+	long nEnd = ftell(m_pFile);
+	if (nEnd < nStart || fread(trailer, 1, sizeof(trailer), m_pFile) != sizeof(trailer))
+	{
+		m_pError = "corrupt gzip file";
+		return false;
+	}
+
+	m_format = EFormat_Deflate;
+	m_nCRC = RomGet32(trailer);
+	m_nCompressedSize = (u32)(nEnd - nStart);
+	fseek(m_pFile, nStart, SEEK_SET);
+	return true;
+}
+
+void RomStream::Close()
+{
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_bStop = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = 0;
+	}
+
+	m_chunks.clear();
+	m_nChunkPos = 0;
+	m_bDone = false;
+	m_bFailed = false;
+	m_bStop = false;
+}
+
+// Queue output for the reader, waits while the read ahead is full
+
+bool RomStream::Output(void *pContext, const u8 *pData, u32 nSize)
+{
+	RomStream *pStream = (RomStream *)pContext;
+	std::unique_lock<std::mutex> lock(pStream->m_lock);
+	pStream->m_cond.wait(lock, [pStream]() { return pStream->m_bStop || pStream->m_chunks.size() < ROMSTREAM_MAX_CHUNKS; });
+	if (pStream->m_bStop)
+	{
+		return false;
+	}
+
+	pStream->m_chunks.emplace_back(pData, pData + nSize);
+	pStream->m_cond.notify_all();
+	return true;
+}
+
+void RomStream::Producer()
+{
+	bool bOk = true;
+	if (m_format == EFormat_Deflate)
+	{
+		u32 nCRC;
+		bOk = Inflate(m_pFile, m_nCompressedSize, Output, this, &nCRC) && (nCRC == m_nCRC);
+	}
+	else
+	{
+		// plain file reads to the end, stored entry only its own data
+		u32 nLeft = m_format == EFormat_Stored ? m_nCompressedSize : 0xffffffff;
+		u32 nCRC = 0;
+		std::vector<u8> buf(ROMSTREAM_CHUNK);
+		while (nLeft)
+		{
+			u32 nRead = (u32)fread(buf.data(), 1, nLeft < ROMSTREAM_CHUNK ? nLeft : ROMSTREAM_CHUNK, m_pFile);
+			if (nRead == 0)
+			{
+				break;
+			}
+			nCRC = Crc32(nCRC, buf.data(), nRead);
+			nLeft -= m_format == EFormat_Stored ? nRead : 0;
+			if (!Output(this, buf.data(), nRead))
+			{
+				bOk = false;
+				break;
+			}
+		}
+		bOk = bOk && (m_format == EFormat_Plain || (nLeft == 0 && nCRC == m_nCRC));
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_bDone = true;
+	m_bFailed = !bOk;
+	m_cond.notify_all();
+}
+
+// Read the next bytes of the image, short only at the end of the data or if
+// decompression failed, GetError says which
+
+u32 RomStream::Read(void *pData, u32 nSize)
+{
+	u8 *pOut = (u8 *)pData;
+	u32 nRead = 0;
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (nRead < nSize)
+	{
+		m_cond.wait(lock, [this]() { return m_bDone || !m_chunks.empty(); });
+		if (m_chunks.empty())
+		{
+			break;
+		}
+
+		std::vector<u8> &chunk = m_chunks.front();
+		u32 nTake = (u32)chunk.size() - m_nChunkPos;
+		if (nTake > nSize - nRead)
+		{
+			nTake = nSize - nRead;
+		}
+		memcpy(pOut + nRead, chunk.data() + m_nChunkPos, nTake);
+		nRead += nTake;
+		m_nChunkPos += nTake;
+
+		if (m_nChunkPos == chunk.size())
+		{
+			m_chunks.pop_front();
+			m_nChunkPos = 0;
+			m_cond.notify_all();
+		}
+	}
+
+	if (nRead < nSize)
+	{
+		m_pError = m_bFailed ? "corrupt data" : "unexpected end of data";
+	}
+	return nRead;
+}
+
+// Read and discard anything left, returns true if the whole stream was
+// valid, archive CRCs are only known once everything has been decompressed
+
+bool RomStream::Finish()
+{
+	u8 buf[4096];
+	while (Read(buf, sizeof(buf)) == sizeof(buf));
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_bFailed)
+	{
+		m_pError = "corrupt data";
+	}
+	return m_bDone && !m_bFailed;
+}
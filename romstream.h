@@ -0,0 +1,60 @@
+#ifndef __7800CMD_ROMSTREAM__
+#define __7800CMD_ROMSTREAM__
+
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "types.h"
+
+// Sequential reader for a ROM image, either a plain file, a gzip file or an
+// entry in a zip archive given as "archive.zip:entry.a78". Data is read and
+// decompressed ahead on a separate thread so it overlaps with uploading.
+
+class RomStream
+{
+public:
+	RomStream();
+	~RomStream();
+
+	bool Open(const char *pPath);
+	void Close();
+
+	u32 Read(void *pData, u32 nSize);
+	bool Finish();
+
+	const char *GetError() const { return m_pError; }
+
+private:
+	enum EFormat
+	{
+		EFormat_Plain,
+		EFormat_Stored,
+		EFormat_Deflate
+	};
+
+	bool OpenZip(const char *pArchive, const char *pEntry);
+	bool OpenGzip();
+	void Producer();
+	static bool Output(void *pContext, const u8 *pData, u32 nSize);
+
+	FILE							*m_pFile;
+	EFormat							m_format;
+	u32								m_nCompressedSize;
+	u32								m_nCRC;
+	const char						*m_pError;
+
+	std::thread						m_thread;
+	std::mutex						m_lock;
+	std::condition_variable			m_cond;
+	std::deque<std::vector<u8>>		m_chunks;
+	u32								m_nChunkPos;
+	bool							m_bDone;
+	bool							m_bFailed;
+	bool							m_bStop;
+};
+
+#endif // __7800CMD_ROMSTREAM__
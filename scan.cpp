@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "scan.h"
+
+// Open the port and see if there's a 7800GD on the other end, probe uses a
+// short timeout as anything else attached simply won't answer
+
+bool ScanProbePort(SPortProbe *pProbe, const char *pPort, u32 nTimeout)
+{
+	// device path is required for ports above COM9
+	char szDevice[32];
+	sprintf_s(szDevice, sizeof(szDevice), "\\\\.\\%s", pPort);
+
+	strncpy_s(pProbe->szPort, sizeof(pProbe->szPort), pPort, _TRUNCATE);
+	pProbe->bFound = false;
+	pProbe->status = EStatus_Menu;
+	pProbe->nLatencyUs = 0;
+
+	COMPORT com = CmdInit(szDevice);
+	if (com == COMPORT_INVALID)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER nFreq, nStart, nEnd;
+	QueryPerformanceFrequency(&nFreq);
+	QueryPerformanceCounter(&nStart);
+
+	E7800Status status;
+	if (ComSetTimeout(com, nTimeout) && CmdStatus(com, &status) && status <= EStatus_Menu)
+	{
+		QueryPerformanceCounter(&nEnd);
+		pProbe->bFound = true;
+		pProbe->status = status;
+		pProbe->nLatencyUs = (u32)(((nEnd.QuadPart - nStart.QuadPart) * 1000000) / nFreq.QuadPart);
+	}
+
+	CmdTerm(com);
+	return pProbe->bFound;
+}
+
+// Enumerate all serial ports and probe them at the same time so ports that
+// don't respond only cost a single timeout in total. Returns the number of
+// ports probed, found or not.
+
+int ScanPorts(SPortProbe *pProbes, int nMax, u32 nTimeout)
+{
+	// list of all dos devices, serial ports are the COMx entries
+	// the list has no fixed size, grow until it fits
+	std::vector<char> devices(65536);
+	while (QueryDosDeviceA(NULL, devices.data(), (DWORD)devices.size()) == 0)
+	{
+		if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || devices.size() >= 16 * 1024 * 1024)
+		{
+			return 0;
+		}
+		devices.resize(devices.size() * 2);
+	}
+
+	std::vector<std::thread> threads;
+	int nPorts = 0;
+	for (const char *pName = devices.data(); *pName && nPorts < nMax; pName += strlen(pName) + 1)
+	{
+		if (_strnicmp(pName, "COM", 3) == 0 && strlen(pName) < sizeof(pProbes->szPort))
+		{
+			SPortProbe *pProbe = &pProbes[nPorts++];
+			std::string port(pName);
+			threads.emplace_back([pProbe, port, nTimeout]() { ScanProbePort(pProbe, port.c_str(), nTimeout); });
+		}
+	}
+
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	return nPorts;
+}
+
+// Settings are stored per port and the same port can be named a few ways,
+// "com3", "COM3:" and "\\.\COM3" all give "COM3". No port gives "default".
+
+void ScanPortKey(char *pKey, u32 nSize, const char *pPort)
+{
+	if (!pPort || !*pPort)
+	{
+		strcpy_s(pKey, nSize, "default");
+		return;
+	}
+
+	if (strncmp(pPort, "\\\\.\\", 4) == 0)
+	{
+		pPort += 4;
+	}
+	strncpy_s(pKey, nSize, pPort, _TRUNCATE);
+
+	size_t nLen = strlen(pKey);
+	if (nLen && pKey[nLen - 1] == ':')
+	{
+		pKey[nLen - 1] = 0;
+	}
+	for (char *p = pKey; *p; p++)
+	{
+		*p = (*p >= 'a' && *p <= 'z') ? *p - 'a' + 'A' : *p;
+	}
+}
+
+// Per user settings live in local app data, or the current directory if
+// that isn't available
+
+void ScanConfigPath(char *pPath, u32 nSize, const char *pName)
+{
+	// too long returns the size needed and leaves the buffer untouched
+	char szDir[MAX_PATH];
+	DWORD nLen = GetEnvironmentVariableA("LOCALAPPDATA", szDir, sizeof(szDir));
+	if (nLen == 0 || nLen >= sizeof(szDir))
+	{
+		szDir[0] = '.';
+		szDir[1] = 0;
+	}
+	sprintf_s(pPath, nSize, "%s\\%s", szDir, pName);
+}
+
+// Last port a 7800GD was found on is cached so it can be used directly,
+// along with how many were found at the time so a choice can be pointed out
+
+bool ScanLoadCache(char *pPort, u32 nSize, int *pFound)
+{
+	char szPath[MAX_PATH + 16];
+	ScanConfigPath(szPath, sizeof(szPath), "7800cmd.port");
+
+	FILE *f;
+	if (fopen_s(&f, szPath, "r") != 0)
+	{
+		return false;
+	}
+
+	bool bOk = fgets(pPort, nSize, f) != 0;
+
+	// count is on the second line, older caches only have the port
+	char szFound[16];
+	int nFound = fgets(szFound, sizeof(szFound), f) ? atoi(szFound) : 1;
+	fclose(f);
+
+	if (pFound)
+	{
+		*pFound = nFound > 0 ? nFound : 1;
+	}
+
+	// strip line end
+	if (bOk)
+	{
+		pPort[strcspn(pPort, "\r\n")] = 0;
+		bOk = pPort[0] != 0;
+	}
+
+	return bOk;
+}
+
+void ScanSaveCache(const char *pPort, int nFound)
+{
+	char szPath[MAX_PATH + 16];
+	ScanConfigPath(szPath, sizeof(szPath), "7800cmd.port");
+
+	FILE *f;
+	if (fopen_s(&f, szPath, "w") == 0)
+	{
+		fprintf(f, "%s\n%d\n", pPort, nFound);
+		fclose(f);
+	}
+}
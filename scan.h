@@ -0,0 +1,21 @@
+#ifndef __7800CMD_SCAN__
+#define __7800CMD_SCAN__
+
+#include "7800cmd.h"
+
+struct SPortProbe
+{
+	char			szPort[16];
+	bool			bFound;
+	E7800Status		status;
+	u32				nLatencyUs;
+};
+
+bool ScanProbePort(SPortProbe *pProbe, const char *pPort, u32 nTimeout);
+int ScanPorts(SPortProbe *pProbes, int nMax, u32 nTimeout);
+bool ScanLoadCache(char *pPort, u32 nSize, int *pFound = 0);
+void ScanSaveCache(const char *pPort, int nFound);
+void ScanConfigPath(char *pPath, u32 nSize, const char *pName);
+void ScanPortKey(char *pKey, u32 nSize, const char *pPort);
+
+#endif // __7800CMD_SCAN__
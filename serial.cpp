@@ -1,11 +1,25 @@
 #include "serial.h"
+#include "serialsim.h"
+
+static volatile LONG s_nBreaks;
+static volatile LONG s_nWrites;
+static volatile LONG s_nReads;
+static volatile LONG s_nBytesWritten;
+static volatile LONG s_nBytesRead;
 
 // Opens the specified serial port, configures its timeouts, and sets its
 // baud rate.  Returns a handle on success, or INVALID_HANDLE_VALUE on failure.
+// The port is always opened for overlapped io, blocking reads and writes
+// wait on the result.
 const COMPORT ComOpen(const char *device, u32 baud_rate)
 {
+	if (SimIsDevice(device))
+	{
+		return SimOpen(device, baud_rate);
+	}
+
 	HANDLE port = CreateFileA(device, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-	OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
 	if (port == INVALID_HANDLE_VALUE)
 	{
 		return COMPORT_INVALID;
@@ -20,15 +34,7 @@ const COMPORT ComOpen(const char *device, u32 baud_rate)
 	}
  
 	// Configure read and write operations
-	COMMTIMEOUTS timeouts = {0};
-	timeouts.ReadIntervalTimeout = 0;
-	timeouts.ReadTotalTimeoutConstant = 500;
-	timeouts.ReadTotalTimeoutMultiplier = 0;
-	timeouts.WriteTotalTimeoutConstant = 500;
-	timeouts.WriteTotalTimeoutMultiplier = 0;
- 
-	success = SetCommTimeouts(port, &timeouts);
-	if (!success)
+	if (!ComSetTimeout(port, 500))
 	{
 		CloseHandle(port);
 		return COMPORT_INVALID;
@@ -53,26 +59,107 @@ const COMPORT ComOpen(const char *device, u32 baud_rate)
 
 void ComClose(const COMPORT h)
 {
+	if (SimIsPort(h))
+	{
+		SimClose(h);
+		return;
+	}
 	CloseHandle(h);
 }
 
-bool ComBreak(const COMPORT h)
+bool ComSetBreak(const COMPORT h, bool bBreak)
 {
-	BOOL bOk = TRUE;
-	bOk &= SetCommBreak(h);
-	Sleep(1);
-	bOk &= ClearCommBreak(h);
-	return bOk;
+	if (bBreak)
+	{
+		InterlockedIncrement(&s_nBreaks);
+	}
+	if (SimIsPort(h))
+	{
+		return SimSetBreak(h, bBreak);
+	}
+	if (bBreak)
+	{
+		return SetCommBreak(h) != 0;
+	}
+	return ClearCommBreak(h) != 0;
+}
+
+// Sets the total timeout in ms for each read and write operation
+
+bool ComSetTimeout(const COMPORT h, u32 nTimeout)
+{
+	if (SimIsPort(h))
+	{
+		return SimSetTimeout(h, nTimeout);
+	}
+
+	COMMTIMEOUTS timeouts = {0};
+	timeouts.ReadIntervalTimeout = 0;
+	timeouts.ReadTotalTimeoutConstant = nTimeout;
+	timeouts.ReadTotalTimeoutMultiplier = 0;
+	timeouts.WriteTotalTimeoutConstant = nTimeout;
+	timeouts.WriteTotalTimeoutMultiplier = 0;
+	return SetCommTimeouts(h, &timeouts) != 0;
+}
+
+bool ComBeginWrite(const COMPORT h, const void *pData, const int nSize, COMPORT_IO *pIO)
+{
+	InterlockedIncrement(&s_nWrites);
+	InterlockedExchangeAdd(&s_nBytesWritten, nSize);
+	if (SimIsPort(h))
+	{
+		return SimBeginWrite(h, pData, nSize, pIO);
+	}
+	return WriteFile(h, pData, nSize, 0, pIO) || (GetLastError() == ERROR_IO_PENDING);
+}
+
+bool ComBeginRead(const COMPORT h, void *pData, const int nSize, COMPORT_IO *pIO)
+{
+	InterlockedIncrement(&s_nReads);
+	InterlockedExchangeAdd(&s_nBytesRead, nSize);
+	if (SimIsPort(h))
+	{
+		return SimBeginRead(h, pData, nSize, pIO);
+	}
+	return ReadFile(h, pData, nSize, 0, pIO) || (GetLastError() == ERROR_IO_PENDING);
+}
+
+// Timeouts complete the transfer short, so it's only ok if everything went
+
+bool ComEndIO(const COMPORT h, COMPORT_IO *pIO, const int nSize)
+{
+	if (SimIsPort(h))
+	{
+		return SimEndIO(h, pIO, nSize);
+	}
+
+	DWORD nDone;
+	return GetOverlappedResult(h, pIO, &nDone, TRUE) && (nDone == nSize);
 }
 
 bool ComWrite(const COMPORT h, const void *pData, const int nSize)
 {
-	DWORD nWritten;
-	return WriteFile(h, pData, nSize, &nWritten, 0) && (nWritten == nSize);
+	OVERLAPPED io = {0};
+	io.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	bool bOk = ComBeginWrite(h, pData, nSize, &io) && ComEndIO(h, &io, nSize);
+	CloseHandle(io.hEvent);
+	return bOk;
 }
 
 bool ComRead(const COMPORT h, void *pData, const int nSize)
 {
-	DWORD nRead;
-	return ReadFile(h, pData, nSize, &nRead, 0) && (nRead == nSize);
+	OVERLAPPED io = {0};
+	io.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	bool bOk = ComBeginRead(h, pData, nSize, &io) && ComEndIO(h, &io, nSize);
+	CloseHandle(io.hEvent);
+	return bOk;
+}
+
+void ComGetStats(SComStats *pStats)
+{
+	pStats->nBreaks = s_nBreaks;
+	pStats->nWrites = s_nWrites;
+	pStats->nReads = s_nReads;
+	pStats->nBytesWritten = s_nBytesWritten;
+	pStats->nBytesRead = s_nBytesRead;
 }
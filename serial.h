@@ -7,11 +7,32 @@
 // windows specific types, redefine for different platforms
 #define COMPORT				HANDLE
 #define COMPORT_INVALID		INVALID_HANDLE_VALUE
+#define COMPORT_IO			OVERLAPPED
 
 const COMPORT ComOpen(const char *device, u32 baud_rate);
 void ComClose(const COMPORT h);
 bool ComWrite(const COMPORT h, const void *pData, const int nSize);
 bool ComRead(const COMPORT h, void *pData, const int nSize);
-bool ComBreak(const COMPORT h);
+bool ComSetBreak(const COMPORT h, bool bBreak);
+bool ComSetTimeout(const COMPORT h, u32 nTimeout);
+
+// asynchronous io, begin starts the transfer and pIO->hEvent is signalled on
+// completion, end collects the result (waiting if required)
+bool ComBeginWrite(const COMPORT h, const void *pData, const int nSize, COMPORT_IO *pIO);
+bool ComBeginRead(const COMPORT h, void *pData, const int nSize, COMPORT_IO *pIO);
+bool ComEndIO(const COMPORT h, COMPORT_IO *pIO, const int nSize);
+
+// call counters for all ports, each write/read is a single OS call and
+// typically a separate USB transfer on USB serial adapters
+struct SComStats
+{
+	u32		nBreaks;
+	u32		nWrites;
+	u32		nReads;
+	u32		nBytesWritten;
+	u32		nBytesRead;
+};
+
+void ComGetStats(SComStats *pStats);
 
 #endif // __7800CMD_SERIAL__
\ No newline at end of file
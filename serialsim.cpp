@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include "serialsim.h"
+
+enum ESimState
+{
+	ESim_Idle,						// waiting for a break
+	ESim_Command,					// waiting for command byte
+	ESim_Params,					// collecting command parameters
+	ESim_Data						// receiving write cart data
+};
+
+struct SSimDevice
+{
+	HANDLE			h;				// unique handle to identify the port
+	u32				nBaudRate;
+	u32				nTimeout;
+	u32				nFailEvery;		// every Nth read times out, 0 never
+	u32				nReads;
+	u64				nBusyUs;		// line is busy until this time
+
+	ESimState		state;
+	u8				nCmd;
+	u8				params[16];
+	u32				nParams;
+	u32				nParamsWanted;
+	u32				nDataLeft;
+	u8				nStatus;
+	std::deque<u8>	reply;
+};
+
+static std::mutex s_lock;
+static SSimDevice *s_pDevices[8];
+
+static SSimDevice *SimFind(const COMPORT h)
+{
+	std::lock_guard<std::mutex> lock(s_lock);
+	for (SSimDevice *pDevice : s_pDevices)
+	{
+		if (pDevice && pDevice->h == h)
+		{
+			return pDevice;
+		}
+	}
+	return 0;
+}
+
+static u32 SimGet32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static u64 SimTimeUs()
+{
+	LARGE_INTEGER nFreq, nNow;
+	QueryPerformanceFrequency(&nFreq);
+	QueryPerformanceCounter(&nNow);
+	return (u64)((nNow.QuadPart * 1000000) / nFreq.QuadPart);
+}
+
+// Transfers complete on a timer once the line would have carried them, so
+// nothing blocks and a single loop can drive several simulated ports. The
+// line is shared by reads and writes, each queues up behind the last.
+
+static VOID CALLBACK SimComplete(PVOID pContext, BOOLEAN bFired)
+{
+	SetEvent((HANDLE)pContext);
+}
+
+static bool SimSchedule(SSimDevice *pDevice, u32 nDone, u64 nUs, COMPORT_IO *pIO)
+{
+	u64 nNow = SimTimeUs();
+	pDevice->nBusyUs = (pDevice->nBusyUs > nNow ? pDevice->nBusyUs : nNow) + nUs;
+
+	pIO->InternalHigh = nDone;
+	pIO->Pointer = 0;
+	DWORD nMs = (DWORD)((pDevice->nBusyUs - nNow) / 1000);
+	if (nMs == 0)
+	{
+		return SetEvent(pIO->hEvent) != 0;
+	}
+
+	HANDLE hTimer;
+	if (!CreateTimerQueueTimer(&hTimer, NULL, SimComplete, pIO->hEvent, nMs, 0, WT_EXECUTEONLYONCE))
+	{
+		return false;
+	}
+	pIO->Pointer = hTimer;
+	return true;
+}
+
+static u64 SimLineUs(SSimDevice *pDevice, const u32 nBytes)
+{
+	return ((u64)nBytes * 10 * 1000000) / pDevice->nBaudRate;
+}
+
+// Command complete once all the parameters have arrived
+
+static void SimCommand(SSimDevice *pDevice)
+{
+	switch (pDevice->nCmd)
+	{
+		// status (0) replies with state, not acknowledge
+		case 0:
+			pDevice->reply.push_back(pDevice->nStatus);
+			break;
+
+		// break (1)
+		case 1:
+			pDevice->nStatus = 1;
+			pDevice->reply.push_back(0);
+			break;
+
+		// return (2)
+		case 2:
+			pDevice->nStatus = 0;
+			pDevice->reply.push_back(0);
+			break;
+
+		// write cart (3), address and size then data
+		case 3:
+		{
+			u32 nAddr = SimGet32(&pDevice->params[0]);
+			u32 nSize = SimGet32(&pDevice->params[4]);
+			if (nAddr + nSize > 0x100000)
+			{
+				pDevice->reply.push_back(1);
+				break;
+			}
+
+			pDevice->reply.push_back(0);
+			pDevice->nDataLeft = nSize;
+			if (nSize)
+			{
+				pDevice->state = ESim_Data;
+				return;
+			}
+			pDevice->reply.push_back(0);
+			break;
+		}
+
+		// execute (4)
+		case 4:
+			pDevice->nStatus = 0;
+			pDevice->reply.push_back(0);
+			break;
+	}
+
+	pDevice->state = ESim_Idle;
+}
+
+static void SimReceive(SSimDevice *pDevice, const u8 *pData, u32 nSize)
+{
+	static const u32 nParamSize[] = { 0, 0, 0, 8, 12 };
+
+	while (nSize)
+	{
+		switch (pDevice->state)
+		{
+			// bytes with no command are ignored
+			case ESim_Idle:
+				nSize = 0;
+				break;
+
+			case ESim_Command:
+				pDevice->nCmd = *pData++;
+				nSize--;
+				if (pDevice->nCmd >= COUNTOF(nParamSize))
+				{
+					pDevice->state = ESim_Idle;
+					break;
+				}
+				pDevice->nParams = 0;
+				pDevice->nParamsWanted = nParamSize[pDevice->nCmd];
+				pDevice->state = ESim_Params;
+				if (pDevice->nParamsWanted == 0)
+				{
+					SimCommand(pDevice);
+				}
+				break;
+
+			case ESim_Params:
+				pDevice->params[pDevice->nParams++] = *pData++;
+				nSize--;
+				if (pDevice->nParams == pDevice->nParamsWanted)
+				{
+					SimCommand(pDevice);
+				}
+				break;
+
+			case ESim_Data:
+			{
+				u32 nTake = nSize < pDevice->nDataLeft ? nSize : pDevice->nDataLeft;
+				pData += nTake;
+				nSize -= nTake;
+				pDevice->nDataLeft -= nTake;
+				if (pDevice->nDataLeft == 0)
+				{
+					pDevice->reply.push_back(0);
+					pDevice->state = ESim_Idle;
+				}
+				break;
+			}
+		}
+	}
+}
+
+bool SimIsDevice(const char *device)
+{
+	return _strnicmp(device, "sim", 3) == 0 && (device[3] == 0 || device[3] == ':');
+}
+
+bool SimIsPort(const COMPORT h)
+{
+	return SimFind(h) != 0;
+}
+
+const COMPORT SimOpen(const char *device, u32 baud_rate)
+{
+	SSimDevice *pDevice = new SSimDevice();
+	pDevice->h = CreateEventA(NULL, TRUE, FALSE, NULL);
+	pDevice->nBaudRate = baud_rate;
+	pDevice->nTimeout = 500;
+	pDevice->nFailEvery = device[3] == ':' ? strtoul(device + 4, 0, 0) : 0;
+	pDevice->state = ESim_Idle;
+	pDevice->nStatus = 2;
+
+	std::lock_guard<std::mutex> lock(s_lock);
+	for (SSimDevice *&pSlot : s_pDevices)
+	{
+		if (!pSlot && pDevice->h)
+		{
+			pSlot = pDevice;
+			return pDevice->h;
+		}
+	}
+
+	if (pDevice->h)
+	{
+		CloseHandle(pDevice->h);
+	}
+	delete pDevice;
+	return COMPORT_INVALID;
+}
+
+void SimClose(const COMPORT h)
+{
+	std::lock_guard<std::mutex> lock(s_lock);
+	for (SSimDevice *&pSlot : s_pDevices)
+	{
+		if (pSlot && pSlot->h == h)
+		{
+			CloseHandle(pSlot->h);
+			delete pSlot;
+			pSlot = 0;
+		}
+	}
+}
+
+// Break starts a new command whatever was happening
+
+bool SimSetBreak(const COMPORT h, bool bBreak)
+{
+	SSimDevice *pDevice = SimFind(h);
+	if (bBreak)
+	{
+		pDevice->state = ESim_Command;
+		pDevice->reply.clear();
+	}
+	return true;
+}
+
+bool SimSetTimeout(const COMPORT h, u32 nTimeout)
+{
+	SimFind(h)->nTimeout = nTimeout;
+	return true;
+}
+
+bool SimBeginWrite(const COMPORT h, const void *pData, const int nSize, COMPORT_IO *pIO)
+{
+	SSimDevice *pDevice = SimFind(h);
+	SimReceive(pDevice, (const u8 *)pData, nSize);
+	return SimSchedule(pDevice, nSize, SimLineUs(pDevice, nSize), pIO);
+}
+
+// Reads with nothing to reply take the full timeout, as does an injected fault
+
+bool SimBeginRead(const COMPORT h, void *pData, const int nSize, COMPORT_IO *pIO)
+{
+	SSimDevice *pDevice = SimFind(h);
+	pDevice->nReads++;
+	if (pDevice->nFailEvery && (pDevice->nReads % pDevice->nFailEvery) == 0)
+	{
+		pDevice->reply.clear();
+	}
+
+	u32 nRead = 0;
+	u8 *p = (u8 *)pData;
+	while (nRead < (u32)nSize && !pDevice->reply.empty())
+	{
+		p[nRead++] = pDevice->reply.front();
+		pDevice->reply.pop_front();
+	}
+
+	u64 nUs = SimLineUs(pDevice, nRead) + (nRead < (u32)nSize ? pDevice->nTimeout * 1000 : 0);
+	return SimSchedule(pDevice, nRead, nUs, pIO);
+}
+
+// Waits for the timer, blocking io ends straight after it begins
+
+bool SimEndIO(const COMPORT h, COMPORT_IO *pIO, const int nSize)
+{
+	WaitForSingleObject(pIO->hEvent, INFINITE);
+	if (pIO->Pointer)
+	{
+		DeleteTimerQueueTimer(NULL, pIO->Pointer, INVALID_HANDLE_VALUE);
+		pIO->Pointer = 0;
+	}
+	return pIO->InternalHigh == (ULONG_PTR)nSize;
+}
@@ -0,0 +1,20 @@
+#ifndef __7800CMD_SERIALSIM__
+#define __7800CMD_SERIALSIM__
+
+#include "serial.h"
+
+// Simulated 7800GD, opened through the serial layer with the port name
+// "sim", or "sim:N" to make every Nth read time out. Transfers complete
+// asynchronously, taking as long as they would at the given baud rate.
+
+bool SimIsDevice(const char *device);
+bool SimIsPort(const COMPORT h);
+const COMPORT SimOpen(const char *device, u32 baud_rate);
+void SimClose(const COMPORT h);
+bool SimSetBreak(const COMPORT h, bool bBreak);
+bool SimSetTimeout(const COMPORT h, u32 nTimeout);
+bool SimBeginWrite(const COMPORT h, const void *pData, const int nSize, COMPORT_IO *pIO);
+bool SimBeginRead(const COMPORT h, void *pData, const int nSize, COMPORT_IO *pIO);
+bool SimEndIO(const COMPORT h, COMPORT_IO *pIO, const int nSize);
+
+#endif // __7800CMD_SERIALSIM__
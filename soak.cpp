@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <windows.h>
+#include <psapi.h>
+#include <vector>
+#include "soak.h"
+
+// Soak test, loops status, break, upload and execute to find problems that
+// only show up over time. Uploads are random slices of the ROM written back
+// to their own address so the image stays valid and can always be executed.
+
+enum ESoakCmd
+{
+	ESoak_Status = 0,
+	ESoak_Break,
+	ESoak_WriteCart,
+	ESoak_Complete,
+	ESoak_Execute,
+	ESoak_Count
+};
+
+static const char *s_pSoakCmdName[ESoak_Count] = { "status", "break", "writecart", "complete", "execute" };
+
+// Latency histogram in 100us buckets, fixed size so tracking doesn't show up
+// as memory growth over the run
+
+static const u32 SOAK_BUCKET_US = 100;
+static const u32 SOAK_BUCKETS = 20000;
+
+struct SSoakHistogram
+{
+	std::vector<u32>	buckets;
+	u32					nCount;
+	u32					nMaxUs;
+};
+
+struct SSoakStats
+{
+	SSoakHistogram		interval[ESoak_Count];
+	SSoakHistogram		total[ESoak_Count];
+	u32					nFailures;			// failed command attempts, typically timeouts
+	u32					nRetries;
+	u64					nBytes;
+	u64					nUploadUs;
+};
+
+static u64 SoakTimeUs()
+{
+	static LARGE_INTEGER nFreq;
+	if (nFreq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&nFreq);
+	}
+	LARGE_INTEGER nNow;
+	QueryPerformanceCounter(&nNow);
+	return (u64)((nNow.QuadPart * 1000000) / nFreq.QuadPart);
+}
+
+// xorshift, repeatable from the seed
+
+static u32 SoakRandom(u32 *pState)
+{
+	u32 x = *pState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *pState = x;
+}
+
+static void SoakReset(SSoakHistogram *pHist)
+{
+	pHist->buckets.assign(SOAK_BUCKETS, 0);
+	pHist->nCount = 0;
+	pHist->nMaxUs = 0;
+}
+
+static void SoakAdd(SSoakHistogram *pHist, u32 nUs)
+{
+	u32 nBucket = nUs / SOAK_BUCKET_US;
+	pHist->buckets[nBucket < SOAK_BUCKETS ? nBucket : SOAK_BUCKETS - 1]++;
+	pHist->nCount++;
+	if (nUs > pHist->nMaxUs)
+	{
+		pHist->nMaxUs = nUs;
+	}
+}
+
+// Percentile in us, top of the bucket it falls in
+
+static u32 SoakPercentile(const SSoakHistogram *pHist, u32 nPercent)
+{
+	u32 nWanted = (pHist->nCount * nPercent + 99) / 100;
+	u32 nSeen = 0;
+	for (u32 n = 0; n < SOAK_BUCKETS; n++)
+	{
+		nSeen += pHist->buckets[n];
+		if (nSeen >= nWanted && nSeen)
+		{
+			u32 nUs = (n + 1) * SOAK_BUCKET_US;
+			return nUs < pHist->nMaxUs ? nUs : pHist->nMaxUs;
+		}
+	}
+	return pHist->nMaxUs;
+}
+
+static void SoakPrintLatency(const SSoakHistogram *pHist)
+{
+	for (int n = 0; n < ESoak_Count; n++)
+	{
+		if (pHist[n].nCount)
+		{
+			printf(" %s %.1f/%.1f/%.1f/%.1fms", s_pSoakCmdName[n],
+				SoakPercentile(&pHist[n], 50) / 1000.0f,
+				SoakPercentile(&pHist[n], 95) / 1000.0f,
+				SoakPercentile(&pHist[n], 99) / 1000.0f,
+				pHist[n].nMaxUs / 1000.0f);
+		}
+	}
+	printf("\n");
+}
+
+static void SoakProcessUsage(u32 *pMemoryK, u32 *pHandles)
+{
+	PROCESS_MEMORY_COUNTERS pmc = {0};
+	DWORD nHandles = 0;
+	GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+	GetProcessHandleCount(GetCurrentProcess(), &nHandles);
+	*pMemoryK = (u32)(pmc.PagefileUsage / 1024);
+	*pHandles = nHandles;
+}
+
+// Time a single command attempt
+
+template<typename F> static bool SoakTimed(SSoakStats *pStats, ESoakCmd cmd, F fn)
+{
+	u64 nStart = SoakTimeUs();
+	bool bOk = fn();
+	u32 nUs = (u32)(SoakTimeUs() - nStart);
+	SoakAdd(&pStats->interval[cmd], nUs);
+	SoakAdd(&pStats->total[cmd], nUs);
+	if (!bOk)
+	{
+		pStats->nFailures++;
+	}
+	return bOk;
+}
+
+// Retry a step a few times before calling it failed
+
+template<typename F> static bool SoakRetry(SSoakStats *pStats, F fn)
+{
+	for (int n = 0; n < 3; n++)
+	{
+		if (n)
+		{
+			pStats->nRetries++;
+		}
+		if (fn())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool SoakUpload(SSoakStats *pStats, const COMPORT com, const u8 *pData, u32 nAddr, u32 nSize)
+{
+	u64 nStart = SoakTimeUs();
+	if (!SoakTimed(pStats, ESoak_WriteCart, [&]() { return CmdWriteCart(com, nAddr, nSize); }))
+	{
+		return false;
+	}
+
+	for (u32 nSent = 0; nSent < nSize; nSent += CMD_DATA_CHUNK)
+	{
+		u32 nChunk = (nSize - nSent) > CMD_DATA_CHUNK ? CMD_DATA_CHUNK : (nSize - nSent);
+		if (!CmdWriteData(com, pData + nSent, nChunk))
+		{
+			pStats->nFailures++;
+			return false;
+		}
+	}
+
+	if (!SoakTimed(pStats, ESoak_Complete, [&]() { return CmdWriteDataComplete(com); }))
+	{
+		return false;
+	}
+
+	pStats->nBytes += nSize;
+	pStats->nUploadUs += SoakTimeUs() - nStart;
+	return true;
+}
+
+static bool SoakBreak(SSoakStats *pStats, const COMPORT com)
+{
+	E7800Status status;
+	return	SoakRetry(pStats, [&]() { return SoakTimed(pStats, ESoak_Status, [&]() { return CmdStatus(com, &status); }); }) &&
+			(status != EStatus_Running || SoakRetry(pStats, [&]() { return SoakTimed(pStats, ESoak_Break, [&]() { return CmdBreak(com); }); }));
+}
+
+static bool SoakExecute(SSoakStats *pStats, const COMPORT com, const GDMapperInfo *pMapper)
+{
+	return SoakRetry(pStats, [&]() { return SoakTimed(pStats, ESoak_Execute, [&]()
+	{
+		return CmdExecute(com, pMapper->nMapper, pMapper->nMapperOptions, pMapper->nMapperAudio, pMapper->nMapperIRQEnable, pMapper->nSize, pMapper->nExtraFlags);
+	}); });
+}
+
+bool Soak(const COMPORT com, const GDMapperInfo *pMapper, const u8 *pImage, const SSoakConfig *pConfig)
+{
+	// slices are picked from within the image, there has to be one
+	if (pMapper->nSize == 0)
+	{
+		printf("Unable to soak, ROM has no data.\n");
+		return false;
+	}
+
+	SSoakStats stats;
+	for (int n = 0; n < ESoak_Count; n++)
+	{
+		SoakReset(&stats.interval[n]);
+		SoakReset(&stats.total[n]);
+	}
+	stats.nFailures = 0;
+	stats.nRetries = 0;
+	stats.nBytes = 0;
+	stats.nUploadUs = 0;
+
+	u32 nRandom = pConfig->nSeed ? pConfig->nSeed : 1;
+	u32 nHalves = IsBankset(pMapper) ? 2 : 1;
+
+	printf("Soak seed %d, %d iterations, %d seconds (0 is no limit)\n", pConfig->nSeed, pConfig->nIterations, pConfig->nDuration);
+
+	// start with the whole image on the cart
+	if (!SoakBreak(&stats, com))
+	{
+		printf("Unable to break.\n");
+		return false;
+	}
+	for (u32 nHalf = 0; nHalf < nHalves; nHalf++)
+	{
+		u32 nAddr = nHalf ? (pMapper->nLoadAddr | 0x80000) : pMapper->nLoadAddr;
+		if (!SoakRetry(&stats, [&]() { return SoakUpload(&stats, com, pImage + nHalf * pMapper->nSize, nAddr, pMapper->nSize); }))
+		{
+			printf("Unable to upload image.\n");
+			return false;
+		}
+	}
+
+	u32 nStartMemoryK, nStartHandles;
+	SoakProcessUsage(&nStartMemoryK, &nStartHandles);
+
+	u64 nStart = SoakTimeUs();
+	u64 nNextReport = nStart + (u64)pConfig->nReportInterval * 1000000;
+	u64 nIntervalBytes = stats.nBytes;
+	u64 nIntervalUs = stats.nUploadUs;
+	float fBaseline = 0.0f;
+	u32 nIteration = 0;
+	u32 nFailedIterations = 0;
+	u32 nConsecutiveFailed = 0;
+
+	while ((pConfig->nIterations == 0 || nIteration < pConfig->nIterations)
+		&& (pConfig->nDuration == 0 || (SoakTimeUs() - nStart) < (u64)pConfig->nDuration * 1000000))
+	{
+		nIteration++;
+
+		// random slice of the image, always uploaded to where it belongs
+		u32 nHalf = SoakRandom(&nRandom) % nHalves;
+		u32 nOffset = SoakRandom(&nRandom) % pMapper->nSize;
+		u32 nMaxSize = pMapper->nSize - nOffset < 0x10000 ? pMapper->nSize - nOffset : 0x10000;
+		u32 nSize = 1 + SoakRandom(&nRandom) % nMaxSize;
+		u32 nAddr = (nHalf ? (pMapper->nLoadAddr | 0x80000) : pMapper->nLoadAddr) + nOffset;
+		const u8 *pData = pImage + nHalf * pMapper->nSize + nOffset;
+
+		bool bOk =	SoakBreak(&stats, com) &&
+					SoakRetry(&stats, [&]() { return SoakUpload(&stats, com, pData, nAddr, nSize); }) &&
+					SoakExecute(&stats, com, pMapper);
+
+		if (bOk)
+		{
+			nConsecutiveFailed = 0;
+		}
+		else
+		{
+			nFailedIterations++;
+			if (++nConsecutiveFailed == 10)
+			{
+				printf("Stopping, %d iterations in a row failed.\n", nConsecutiveFailed);
+				break;
+			}
+		}
+
+		// rolling report
+		u64 nNow = SoakTimeUs();
+		if (nNow >= nNextReport)
+		{
+			u64 nBytes = stats.nBytes - nIntervalBytes;
+			u64 nUs = stats.nUploadUs - nIntervalUs;
+			float fRate = nUs ? (float)((nBytes * 1000000.0) / (nUs * 1024.0)) : 0.0f;
+			if (fBaseline == 0.0f)
+			{
+				fBaseline = fRate;
+			}
+
+			u32 nMemoryK, nHandles;
+			SoakProcessUsage(&nMemoryK, &nHandles);
+
+			printf("[%6ds] %d iterations, %.1fKB/s (%+.1f%%), %d failed, %d failures, %d retries, %dK (%+dK), %d handles (%+d)\n",
+				(int)((nNow - nStart) / 1000000), nIteration, fRate, fBaseline ? (fRate - fBaseline) * 100.0f / fBaseline : 0.0f,
+				nFailedIterations, stats.nFailures, stats.nRetries,
+				nMemoryK, (int)(nMemoryK - nStartMemoryK), nHandles, (int)(nHandles - nStartHandles));
+			printf("         ");
+			SoakPrintLatency(stats.interval);
+
+			for (int n = 0; n < ESoak_Count; n++)
+			{
+				SoakReset(&stats.interval[n]);
+			}
+			nIntervalBytes = stats.nBytes;
+			nIntervalUs = stats.nUploadUs;
+			nNextReport = nNow + (u64)pConfig->nReportInterval * 1000000;
+		}
+	}
+
+	// summary over the whole run
+	u32 nMemoryK, nHandles;
+	SoakProcessUsage(&nMemoryK, &nHandles);
+	float fRate = stats.nUploadUs ? (float)((stats.nBytes * 1000000.0) / (stats.nUploadUs * 1024.0)) : 0.0f;
+	printf("Soak done: %d iterations in %ds, %d failed, %d failures, %d retries, %.1fKB/s, %dK (%+dK), %d handles (%+d)\n",
+		nIteration, (int)((SoakTimeUs() - nStart) / 1000000), nFailedIterations, stats.nFailures, stats.nRetries, fRate,
+		nMemoryK, (int)(nMemoryK - nStartMemoryK), nHandles, (int)(nHandles - nStartHandles));
+	printf("Latency p50/p95/p99/max:");
+	SoakPrintLatency(stats.total);
+
+	return nFailedIterations == 0;
+}
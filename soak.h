@@ -0,0 +1,17 @@
+#ifndef __7800CMD_SOAK__
+#define __7800CMD_SOAK__
+
+#include "7800cmd.h"
+#include "mapper.h"
+
+struct SSoakConfig
+{
+	u32		nIterations;			// 0 for no limit
+	u32		nDuration;				// seconds, 0 for no limit
+	u32		nSeed;
+	u32		nReportInterval;		// seconds between progress reports
+};
+
+bool Soak(const COMPORT com, const GDMapperInfo *pMapper, const u8 *pImage, const SSoakConfig *pConfig);
+
+#endif // __7800CMD_SOAK__